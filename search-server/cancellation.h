@@ -0,0 +1,40 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+
+//Бросается, если поиск прерван отменой или истёк крайний срок
+class QueryCancelled : public std::runtime_error {
+public:
+    QueryCancelled() : std::runtime_error("Query cancelled") {}
+};
+
+//Флаг отмены запроса с необязательным крайним сроком
+class CancellationToken {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    CancellationToken() = default;
+
+    explicit CancellationToken(Clock::time_point deadline) : deadline_(deadline) {}
+
+    void Cancel() {
+        cancelled_.store(true, std::memory_order_relaxed);
+    }
+
+    bool IsCancelled() const {
+        return cancelled_.load(std::memory_order_relaxed) || Clock::now() >= deadline_;
+    }
+
+    //Clock::time_point::max(), если срока нет
+    Clock::time_point GetDeadline() const {
+        return deadline_;
+    }
+
+private:
+    std::atomic<bool> cancelled_{false};
+    Clock::time_point deadline_ = Clock::time_point::max();
+};
+
+//Сколько документов обходить между проверками отмены
+const int CANCELLATION_CHECK_INTERVAL = 1024;
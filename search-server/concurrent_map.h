@@ -8,69 +8,439 @@
 #include <string>
 #include <vector>
 #include <mutex>
+#include <shared_mutex>
 #include <atomic>
+#include <memory>
+#include <optional>
+#include <functional>
+#include <thread>
+#include <utility>
 #include "log_duration.h"
-#include <future>
-#include <type_traits>
-#include <future>
 #include <iterator>
 #include <type_traits>
 #include <execution>
 
 using namespace std::string_literals;
-template <typename Key, typename Value>
+
+//Хеш-таблица, разбитая на полосы со своей блокировкой. Внутри полосы — открытая адресация
+//с линейным пробированием. Ключ — любой хешируемый тип с конструктором по умолчанию.
+//Для скалярного ключа и арифметического значения чтение (Find) идёт без блокировки: версия полосы
+//сверяется до и после, а заменённый массив освобождается, когда его не читает ни один Find.
+//Ключи-строки (в том числе string_view) читаются под разделяемой блокировкой: рваное чтение
+//указателя строки без блокировки нельзя безопасно сравнить с ключом.
+//Add для арифметических значений меняет существующую запись атомарно под разделяемой блокировкой
+template <typename Key, typename Value, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
 class ConcurrentMap {
+    static constexpr bool ATOMIC_VALUE = std::is_arithmetic_v<Value>;
+    static constexpr bool OPTIMISTIC_READS = ATOMIC_VALUE && std::is_scalar_v<Key>;
+
+    using StoredKey = std::conditional_t<OPTIMISTIC_READS, std::atomic<Key>, Key>;
+    using StoredValue = std::conditional_t<ATOMIC_VALUE, std::atomic<Value>, Value>;
+    struct NoCopy {};
+
 public:
-    static_assert(std::is_integral_v<Key>, "ConcurrentMap supports only integer keys"s);
+    //Доступ к значению под исключительной блокировкой полосы. Арифметическое значение
+    //правится в копии и записывается обратно при уничтожении Access
+    class Access {
+    public:
+        Access(std::unique_lock<std::shared_mutex>&& lock, StoredValue& stored)
+            : guard_(std::move(lock))
+            , stored_(stored)
+            , copy_(LoadCopy(stored))
+            , ref_to_value(GetReference())
+        {
+        }
 
-    struct Access {
-       Access(std::vector<std::mutex>& mutex_v, size_t group, uint64_t ukey, std::vector<std::map<Key, Value>>& map_in)
-       : guard(mutex_v[group]), ref_to_value(map_in[group][ukey]) {}
+        Access(const Access&) = delete;
+        Access& operator=(const Access&) = delete;
 
+        ~Access() {
+            if constexpr (ATOMIC_VALUE) {
+                stored_.store(copy_, std::memory_order_relaxed);
+            }
+        }
 
-       std::lock_guard<std::mutex> guard;
-       Value& ref_to_value;
+    private:
+        std::unique_lock<std::shared_mutex> guard_;
+        StoredValue& stored_;
+        std::conditional_t<ATOMIC_VALUE, Value, NoCopy> copy_;
 
-    };
+        static auto LoadCopy(StoredValue& stored) {
+            if constexpr (ATOMIC_VALUE) {
+                return stored.load(std::memory_order_relaxed);
+            } else {
+                return NoCopy{};
+            }
+        }
 
-    explicit ConcurrentMap(size_t bucket_count): vector_maps_(bucket_count), mutexs_(bucket_count){
+        Value& GetReference() {
+            if constexpr (ATOMIC_VALUE) {
+                return copy_;
+            } else {
+                return stored_;
+            }
+        }
+
+    public:
+        Value& ref_to_value;
     };
 
-    Access operator[](const Key& key){
-      std::atomic<uint64_t> ukey = static_cast<uint64_t>(key);
-      size_t size = vector_maps_.size();
-      size_t group = (vector_maps_.size() == 0 ? 0 : ukey % size);
-      while(group >= size) group = ukey % size;
+    explicit ConcurrentMap(size_t bucket_count, Hash hash = Hash(), KeyEqual key_equal = KeyEqual())
+        : stripes_(std::max<size_t>(bucket_count, 1))
+        , hash_(std::move(hash))
+        , key_equal_(std::move(key_equal))
+    {
+    }
+
+    Access operator[](const Key& key) {
+        const size_t hash = GetHash(key);
+        Stripe& stripe = GetStripe(hash);
+        std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+        return Access(std::move(lock), FindOrInsert(stripe, key, hash).value);
+    }
+
+    //Прибавляет delta к значению ключа, при отсутствии ключа вставляет его
+    void Add(const Key& key, Value delta) {
+        static_assert(ATOMIC_VALUE, "ConcurrentMap::Add needs an arithmetic value");
+        const size_t hash = GetHash(key);
+        Stripe& stripe = GetStripe(hash);
+        {
+            std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+            if (Slot* slot = FindSlot(stripe.table.load(std::memory_order_relaxed), key, hash)) {
+                AtomicAdd(slot->value, delta);
+                return;
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+        AtomicAdd(FindOrInsert(stripe, key, hash).value, delta);
+    }
+
+    std::optional<Value> Find(const Key& key) const {
+        const size_t hash = GetHash(key);
+        const Stripe& stripe = GetStripe(hash);
+        if constexpr (OPTIMISTIC_READS) {
+            //Счётчик читателей не даёт Rehash освободить массив, который ещё читается
+            stripe.readers.fetch_add(1, std::memory_order_seq_cst);
+            for (int attempt = 0; attempt < OPTIMISTIC_ATTEMPTS; ++attempt) {
+                const uint64_t version = stripe.version.load(std::memory_order_acquire);
+                if (version % 2 == 1) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                std::optional<Value> result;
+                if (const Slot* slot = FindSlot(stripe.table.load(std::memory_order_seq_cst), key, hash)) {
+                    result = slot->value.load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (stripe.version.load(std::memory_order_relaxed) == version) {
+                    stripe.readers.fetch_sub(1, std::memory_order_seq_cst);
+                    return result;
+                }
+            }
+            stripe.readers.fetch_sub(1, std::memory_order_seq_cst);
+        }
+        std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+        if (const Slot* slot = FindSlot(stripe.table.load(std::memory_order_relaxed), key, hash)) {
+            return LoadValue(slot->value);
+        }
+        return std::nullopt;
+    }
+
+    void erase(const Key& key) {
+        const size_t hash = GetHash(key);
+        Stripe& stripe = GetStripe(hash);
+        std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+        Slot* slot = FindSlot(stripe.table.load(std::memory_order_relaxed), key, hash);
+        if (slot == nullptr) {
+            return;
+        }
+        //Ключ остаётся на месте, чтобы не рвать цепочки проб; слот займёт следующая вставка или перестройка
+        stripe.version.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot->state.store(DELETED, std::memory_order_relaxed);
+        stripe.version.fetch_add(1, std::memory_order_release);
+        --stripe.size;
+    }
 
+    //Байты, занятые массивами слотов, включая заменённые, которые ещё могут читаться
+    size_t GetTableBytes() const {
+        size_t result = 0;
+        for (const Stripe& stripe : stripes_) {
+            std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+            if (stripe.owned != nullptr) {
+                result += stripe.owned->capacity * sizeof(Slot);
+            }
+            for (const auto& table : stripe.retired) {
+                result += table->capacity * sizeof(Slot);
+            }
+        }
+        return result;
+    }
 
-      return Access(mutexs_, group, ukey, vector_maps_);
+    size_t size() const {
+        size_t result = 0;
+        for (const Stripe& stripe : stripes_) {
+            std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+            result += stripe.size;
+        }
+        return result;
     }
 
-    void erase(const Key& key){
-      std::atomic<uint64_t> ukey = static_cast<uint64_t>(key);
-      size_t size = vector_maps_.size();
-      size_t group = (vector_maps_.size() == 0 ? 0 : ukey % size);
-      while(group >= size) group = ukey % size;
+    //Забирает все записи, карта остаётся пустой. Полосы переносятся параллельно, каждая в свой участок результата
+    template <typename ExecutionPolicy>
+    std::vector<std::pair<Key, Value>> Extract(ExecutionPolicy policy) {
+        return Export(policy, true);
+    }
 
-      std::lock_guard<std::mutex> lock(mutexs_[group]);
-      auto erase_elem = vector_maps_[group].find(key);
-      if(erase_elem != vector_maps_[group].end())
-        vector_maps_[group].erase(erase_elem);
+    std::map<Key, Value> BuildOrdinaryMap() {
+        auto entries = Export(std::execution::par, false);
+        std::sort(std::execution::par, entries.begin(), entries.end(), [](const auto& lhs, const auto& rhs) {
+            return lhs.first < rhs.first;
+        });
+        std::map<Key, Value> all_map;
+        for (auto& entry : entries) {
+            all_map.emplace_hint(all_map.end(), std::move(entry));
+        }
+        return all_map;
     }
 
+private:
+    static constexpr int OPTIMISTIC_ATTEMPTS = 4;
+    static constexpr size_t MIN_CAPACITY = 8;
+
+    enum SlotState : uint8_t { EMPTY, FULL, DELETED };
 
-    std::map<Key, Value> BuildOrdinaryMap(){
-      std::map<Key, Value> all_map;
-      for(size_t i = 0; i < mutexs_.size(); ++i) {
-        std::lock_guard<std::mutex> lock(mutexs_[i]);
-        all_map.insert(vector_maps_[i].begin(), vector_maps_[i].end());
-      }
-      return all_map;
+    struct Slot {
+        std::atomic<uint8_t> state{EMPTY};
+        StoredKey key{};
+        StoredValue value{};
     };
 
-private:
-    std::vector<std::map<Key, Value>> vector_maps_;
-    std::vector<std::mutex> mutexs_;
+    struct Table {
+        explicit Table(size_t capacity) : slots(new Slot[capacity]), capacity(capacity) {}
+
+        std::unique_ptr<Slot[]> slots;
+        size_t capacity;
+    };
+
+    //Полоса на своей кэш-линии, чтобы блокировки соседей не делили её
+    struct alignas(64) Stripe {
+        mutable std::shared_mutex mutex;
+        //Нечётная, пока меняются ключи или массив; по ней проверяется чтение без блокировки
+        std::atomic<uint64_t> version{0};
+        std::atomic<Table*> table{nullptr};
+        std::unique_ptr<Table> owned;
+        //Заменённые массивы: их ещё может дочитывать Find без блокировки
+        std::vector<std::unique_ptr<Table>> retired;
+        //Сколько Find сейчас читают полосу без блокировки
+        mutable std::atomic<size_t> readers{0};
+        size_t size = 0;
+        //Занятые и удалённые слоты
+        size_t used = 0;
+    };
+
+    std::vector<Stripe> stripes_;
+    Hash hash_;
+    KeyEqual key_equal_;
+
+    size_t GetHash(const Key& key) const {
+        //Перемешивание: std::hash целых чисел — тождественная функция
+        const uint64_t hash = static_cast<uint64_t>(hash_(key)) * 0x9E3779B97F4A7C15ull;
+        return static_cast<size_t>(hash ^ (hash >> 32));
+    }
+
+    Stripe& GetStripe(size_t hash) {
+        return stripes_[(hash >> 16) % stripes_.size()];
+    }
+
+    const Stripe& GetStripe(size_t hash) const {
+        return stripes_[(hash >> 16) % stripes_.size()];
+    }
+
+    static Key LoadKey(const StoredKey& key) {
+        if constexpr (OPTIMISTIC_READS) {
+            return key.load(std::memory_order_relaxed);
+        } else {
+            return key;
+        }
+    }
+
+    static Value LoadValue(const StoredValue& value) {
+        if constexpr (ATOMIC_VALUE) {
+            return value.load(std::memory_order_relaxed);
+        } else {
+            return value;
+        }
+    }
+
+    static void AtomicAdd(StoredValue& value, Value delta) {
+        if constexpr (std::is_integral_v<Value>) {
+            value.fetch_add(delta, std::memory_order_relaxed);
+        } else {
+            Value current = value.load(std::memory_order_relaxed);
+            while (!value.compare_exchange_weak(current, current + delta, std::memory_order_relaxed)) {
+            }
+        }
+    }
+
+    Slot* FindSlot(Table* table, const Key& key, size_t hash) const {
+        if (table == nullptr) {
+            return nullptr;
+        }
+        const size_t mask = table->capacity - 1;
+        for (size_t index = hash & mask, step = 0; step < table->capacity; index = (index + 1) & mask, ++step) {
+            Slot& slot = table->slots[index];
+            const uint8_t state = slot.state.load(std::memory_order_relaxed);
+            if (state == EMPTY) {
+                return nullptr;
+            }
+            if (state == FULL && key_equal_(LoadKey(slot.key), key)) {
+                return &slot;
+            }
+        }
+        return nullptr;
+    }
+
+    //Вызывается под исключительной блокировкой полосы
+    Slot& FindOrInsert(Stripe& stripe, const Key& key, size_t hash) {
+        if (Slot* slot = FindSlot(stripe.table.load(std::memory_order_relaxed), key, hash)) {
+            return *slot;
+        }
+        Table* table = stripe.table.load(std::memory_order_relaxed);
+        if (table == nullptr || (stripe.used + 1) * 4 > table->capacity * 3) {
+            Rehash(stripe);
+            table = stripe.table.load(std::memory_order_relaxed);
+        }
+
+        const size_t mask = table->capacity - 1;
+        size_t index = hash & mask;
+        while (table->slots[index].state.load(std::memory_order_relaxed) == FULL) {
+            index = (index + 1) & mask;
+        }
+        Slot& slot = table->slots[index];
+        stripe.version.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        if (slot.state.load(std::memory_order_relaxed) == EMPTY) {
+            ++stripe.used;
+        }
+        StoreKey(slot.key, key);
+        StoreValue(slot.value, Value{});
+        slot.state.store(FULL, std::memory_order_relaxed);
+        stripe.version.fetch_add(1, std::memory_order_release);
+        ++stripe.size;
+        return slot;
+    }
+
+    static void StoreKey(StoredKey& stored, const Key& key) {
+        if constexpr (OPTIMISTIC_READS) {
+            stored.store(key, std::memory_order_relaxed);
+        } else {
+            stored = key;
+        }
+    }
+
+    template <typename T>
+    static void StoreValue(StoredValue& stored, T&& value) {
+        if constexpr (ATOMIC_VALUE) {
+            stored.store(value, std::memory_order_relaxed);
+        } else {
+            stored = std::forward<T>(value);
+        }
+    }
+
+    //Новый массив: вдвое больше записей или того же размера, если место заняли удалённые
+    void Rehash(Stripe& stripe) {
+        Table* old_table = stripe.table.load(std::memory_order_relaxed);
+        size_t capacity = MIN_CAPACITY;
+        while (capacity < (stripe.size + 1) * 2) {
+            capacity *= 2;
+        }
+        auto table = std::make_unique<Table>(capacity);
+        if (old_table != nullptr) {
+            for (size_t i = 0; i < old_table->capacity; ++i) {
+                Slot& old_slot = old_table->slots[i];
+                if (old_slot.state.load(std::memory_order_relaxed) != FULL) {
+                    continue;
+                }
+                const Key key = LoadKey(old_slot.key);
+                size_t index = GetHash(key) & (capacity - 1);
+                while (table->slots[index].state.load(std::memory_order_relaxed) == FULL) {
+                    index = (index + 1) & (capacity - 1);
+                }
+                Slot& slot = table->slots[index];
+                StoreKey(slot.key, key);
+                if constexpr (ATOMIC_VALUE) {
+                    StoreValue(slot.value, LoadValue(old_slot.value));
+                } else {
+                    StoreValue(slot.value, std::move(old_slot.value));
+                }
+                slot.state.store(FULL, std::memory_order_relaxed);
+            }
+        }
+
+        stripe.version.fetch_add(1, std::memory_order_relaxed);
+        stripe.table.store(table.get(), std::memory_order_seq_cst);
+        stripe.version.fetch_add(1, std::memory_order_release);
+        if constexpr (OPTIMISTIC_READS) {
+            if (stripe.owned != nullptr) {
+                stripe.retired.push_back(std::move(stripe.owned));
+            }
+            //Новый массив уже опубликован: Find, начавший читать после проверки, возьмёт его,
+            //а без читателей старые массивы никто не держит. Иначе их освободит следующая перестройка
+            if (stripe.readers.load(std::memory_order_seq_cst) == 0) {
+                stripe.retired.clear();
+            }
+        }
+        stripe.owned = std::move(table);
+        stripe.used = stripe.size;
+    }
+
+    template <typename ExecutionPolicy>
+    std::vector<std::pair<Key, Value>> Export(ExecutionPolicy policy, bool clear) {
+        std::vector<std::unique_lock<std::shared_mutex>> locks;
+        locks.reserve(stripes_.size());
+        std::vector<size_t> offsets(stripes_.size() + 1, 0);
+        for (size_t i = 0; i < stripes_.size(); ++i) {
+            locks.emplace_back(stripes_[i].mutex);
+            offsets[i + 1] = offsets[i] + stripes_[i].size;
+        }
+
+        std::vector<std::pair<Key, Value>> entries(offsets.back());
+        std::vector<size_t> indexes(stripes_.size());
+        std::iota(indexes.begin(), indexes.end(), 0);
+        std::for_each(policy, indexes.begin(), indexes.end(), [this, clear, &offsets, &entries](size_t i) {
+            Stripe& stripe = stripes_[i];
+            Table* table = stripe.table.load(std::memory_order_relaxed);
+            if (table == nullptr) {
+                return;
+            }
+            size_t position = offsets[i];
+            for (size_t index = 0; index < table->capacity; ++index) {
+                Slot& slot = table->slots[index];
+                if (slot.state.load(std::memory_order_relaxed) != FULL) {
+                    continue;
+                }
+                if constexpr (ATOMIC_VALUE) {
+                    entries[position++] = {LoadKey(slot.key), LoadValue(slot.value)};
+                } else if (clear) {
+                    entries[position++] = {LoadKey(slot.key), std::move(slot.value)};
+                } else {
+                    entries[position++] = {LoadKey(slot.key), slot.value};
+                }
+            }
+            if (clear) {
+                stripe.version.fetch_add(1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                for (size_t index = 0; index < table->capacity; ++index) {
+                    table->slots[index].state.store(EMPTY, std::memory_order_relaxed);
+                }
+                stripe.version.fetch_add(1, std::memory_order_release);
+                stripe.size = 0;
+                stripe.used = 0;
+            }
+        });
+        return entries;
+    }
 };
 
 using namespace std;
@@ -0,0 +1,93 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <scoped_allocator>
+#include <set>
+#include <type_traits>
+#include <utility>
+
+//Сколько байт сейчас выделено через аллокаторы, привязанные к счётчику
+struct MemoryCounter {
+    std::atomic<size_t> bytes{0};
+};
+
+//Обычный std::allocator, который ведёт учёт выделенной памяти в MemoryCounter.
+//Аллокатор по умолчанию (без счётчика) ничего не считает
+template <typename T>
+class CountingAllocator {
+public:
+    using value_type = T;
+
+    CountingAllocator() noexcept = default;
+
+    explicit CountingAllocator(MemoryCounter* counter) noexcept : counter_(counter) {}
+
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>& other) noexcept : counter_(other.GetCounter()) {}
+
+    T* allocate(size_t n) {
+        T* result = std::allocator<T>().allocate(n);
+        if (counter_ != nullptr) {
+            counter_->bytes.fetch_add(n * sizeof(T), std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+    void deallocate(T* pointer, size_t n) noexcept {
+        if (counter_ != nullptr) {
+            counter_->bytes.fetch_sub(n * sizeof(T), std::memory_order_relaxed);
+        }
+        std::allocator<T>().deallocate(pointer, n);
+    }
+
+    MemoryCounter* GetCounter() const noexcept {
+        return counter_;
+    }
+
+private:
+    MemoryCounter* counter_ = nullptr;
+};
+
+template <typename T, typename U>
+bool operator==(const CountingAllocator<T>& lhs, const CountingAllocator<U>& rhs) {
+    return lhs.GetCounter() == rhs.GetCounter();
+}
+
+template <typename T, typename U>
+bool operator!=(const CountingAllocator<T>& lhs, const CountingAllocator<U>& rhs) {
+    return !(lhs == rhs);
+}
+
+template <typename Key, typename Value, typename Compare = std::less<Key>>
+using CountedMap = std::map<Key, Value, Compare, std::scoped_allocator_adaptor<CountingAllocator<std::pair<const Key, Value>>>>;
+
+//Вложенная мапа: узлы внешней и внутренних мап считаются разными счётчиками
+template <typename Key, typename InnerKey, typename InnerValue>
+using CountedNestedMap = std::map<Key, CountedMap<InnerKey, InnerValue>, std::less<Key>,
+                                  std::scoped_allocator_adaptor<CountingAllocator<std::pair<const Key, CountedMap<InnerKey, InnerValue>>>,
+                                                                CountingAllocator<std::pair<const InnerKey, InnerValue>>>>;
+
+template <typename Key, typename Compare = std::less<Key>>
+using CountedSet = std::set<Key, Compare, CountingAllocator<Key>>;
+
+//Аллокатор для CountedMap/CountedSet, считающий в counter
+template <typename Container>
+typename Container::allocator_type MakeCountingAllocator(MemoryCounter* counter) {
+    using Allocator = typename Container::allocator_type;
+    if constexpr (std::is_constructible_v<Allocator, MemoryCounter*>) {
+        return Allocator(counter);
+    } else {
+        return Allocator(typename Allocator::outer_allocator_type(counter));
+    }
+}
+
+//Аллокатор для CountedNestedMap: внешняя мапа считает в outer, внутренние в inner
+template <typename NestedMap>
+typename NestedMap::allocator_type MakeCountingAllocator(MemoryCounter* outer, MemoryCounter* inner) {
+    using Allocator = typename NestedMap::allocator_type;
+    using InnerAllocator = typename Allocator::inner_allocator_type::outer_allocator_type;
+    return Allocator(typename Allocator::outer_allocator_type(outer), InnerAllocator(inner));
+}
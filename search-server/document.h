@@ -2,6 +2,12 @@
 #include <iostream>
 
 
+enum class DocumentStatus {
+    ACTUAL,
+    IRRELEVANT,
+    BANNED,
+    REMOVED,
+};
 
 struct Document {
     Document();
@@ -0,0 +1,253 @@
+#include "document_store.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+const size_t MIN_MATCH = 4;
+const size_t MAX_OFFSET = 65535;
+const int HASH_BITS = 12;
+
+uint32_t Read32(const char* data) {
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+uint32_t Hash(uint32_t value) {
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+//Длина больше 15 дописывается байтами по 255 и остатком, как в LZ4
+void WriteLength(std::string& out, size_t length) {
+    while (length >= 255) {
+        out.push_back(static_cast<char>(255));
+        length -= 255;
+    }
+    out.push_back(static_cast<char>(length));
+}
+
+size_t ReadLength(const std::string_view data, size_t& pos) {
+    size_t length = 0;
+    unsigned char byte = 255;
+    while (byte == 255) {
+        if (pos >= data.size()) {
+            throw std::runtime_error("Corrupted compressed block");
+        }
+        byte = static_cast<unsigned char>(data[pos++]);
+        length += byte;
+    }
+    return length;
+}
+
+void WriteSequence(std::string& out, const std::string_view literals, size_t offset, size_t match_length) {
+    const size_t literal_code = std::min<size_t>(literals.size(), 15);
+    const size_t match_code = match_length == 0 ? 0 : std::min<size_t>(match_length - MIN_MATCH, 15);
+    out.push_back(static_cast<char>((literal_code << 4) | match_code));
+    if (literal_code == 15) {
+        WriteLength(out, literals.size() - 15);
+    }
+    out.append(literals);
+    if (match_length == 0) {
+        return;
+    }
+    out.push_back(static_cast<char>(offset & 0xFF));
+    out.push_back(static_cast<char>(offset >> 8));
+    if (match_code == 15) {
+        WriteLength(out, match_length - MIN_MATCH - 15);
+    }
+}
+
+}  // namespace
+
+std::string CompressBlock(const std::string_view data) {
+    std::string out;
+    out.reserve(data.size() / 2 + 16);
+    std::vector<int> table(1 << HASH_BITS, -1);
+
+    size_t anchor = 0;
+    size_t pos = 0;
+    while (pos + MIN_MATCH <= data.size()) {
+        const uint32_t value = Read32(data.data() + pos);
+        const uint32_t hash = Hash(value);
+        const int candidate = table[hash];
+        table[hash] = static_cast<int>(pos);
+
+        if (candidate >= 0 && pos - static_cast<size_t>(candidate) <= MAX_OFFSET && Read32(data.data() + candidate) == value) {
+            size_t match_length = MIN_MATCH;
+            while (pos + match_length < data.size() && data[candidate + match_length] == data[pos + match_length]) {
+                ++match_length;
+            }
+            WriteSequence(out, data.substr(anchor, pos - anchor), pos - candidate, match_length);
+            pos += match_length;
+            anchor = pos;
+        } else {
+            ++pos;
+        }
+    }
+    //Последняя последовательность состоит только из литералов
+    WriteSequence(out, data.substr(anchor), 0, 0);
+    return out;
+}
+
+std::string DecompressBlock(const std::string_view data, size_t raw_size) {
+    std::string out;
+    out.reserve(raw_size);
+
+    size_t pos = 0;
+    while (pos < data.size()) {
+        const unsigned char token = static_cast<unsigned char>(data[pos++]);
+        size_t literal_length = token >> 4;
+        if (literal_length == 15) {
+            literal_length += ReadLength(data, pos);
+        }
+        if (pos + literal_length > data.size()) {
+            throw std::runtime_error("Corrupted compressed block");
+        }
+        out.append(data.substr(pos, literal_length));
+        pos += literal_length;
+        if (pos >= data.size()) {
+            break;
+        }
+
+        if (pos + 2 > data.size()) {
+            throw std::runtime_error("Corrupted compressed block");
+        }
+        const size_t offset = static_cast<unsigned char>(data[pos]) | (static_cast<unsigned char>(data[pos + 1]) << 8);
+        pos += 2;
+        size_t match_length = (token & 0x0F) + MIN_MATCH;
+        if ((token & 0x0F) == 15) {
+            match_length += ReadLength(data, pos);
+        }
+        if (offset == 0 || offset > out.size()) {
+            throw std::runtime_error("Corrupted compressed block");
+        }
+        //Совпадение может перекрываться с тем, что копируем, поэтому по одному байту
+        size_t from = out.size() - offset;
+        for (size_t i = 0; i < match_length; ++i) {
+            out.push_back(out[from + i]);
+        }
+    }
+
+    if (out.size() != raw_size) {
+        throw std::runtime_error("Corrupted compressed block");
+    }
+    return out;
+}
+
+DocumentStore::Reader::Reader(const DocumentStore& store)
+    : store_(store)
+    , raw_block_index_(store.blocks_.size())
+{
+}
+
+std::string_view DocumentStore::Reader::Get(const Location& location) {
+    if (store_.mode_ == TextStorageMode::NONE) {
+        throw std::logic_error("Document texts are not stored");
+    }
+    const Block& block = store_.blocks_.at(location.block);
+    if (!block.compressed) {
+        return std::string_view(block.data).substr(location.offset, location.length);
+    }
+    if (location.block != raw_block_index_) {
+        raw_block_ = DecompressBlock(block.data, block.raw_size);
+        raw_block_index_ = location.block;
+    }
+    return std::string_view(raw_block_).substr(location.offset, location.length);
+}
+
+DocumentStore::DocumentStore(TextStorageMode mode) : mode_(mode) {}
+
+TextStorageMode DocumentStore::GetMode() const {
+    return mode_;
+}
+
+DocumentStore::Location DocumentStore::Add(const std::string_view text) {
+    if (mode_ == TextStorageMode::NONE) {
+        return {};
+    }
+
+    if (blocks_.empty() || blocks_.back().sealed
+        || (blocks_.back().raw_size > 0 && blocks_.back().raw_size + text.size() > BLOCK_SIZE)) {
+        if (!blocks_.empty()) {
+            SealLastBlock();
+        }
+        blocks_.emplace_back();
+        blocks_.back().data.reserve(std::max(BLOCK_SIZE, text.size()));
+        stored_bytes_ += blocks_.back().data.capacity();
+    }
+
+    Block& block = blocks_.back();
+    Location location{static_cast<uint32_t>(blocks_.size() - 1), static_cast<uint32_t>(block.raw_size), static_cast<uint32_t>(text.size())};
+    block.data.append(text);
+    block.raw_size += text.size();
+    block.live_bytes += text.size();
+    return location;
+}
+
+std::string DocumentStore::Get(const Location& location) const {
+    if (mode_ == TextStorageMode::NONE) {
+        throw std::logic_error("Document texts are not stored");
+    }
+    const Block& block = blocks_.at(location.block);
+    if (block.compressed) {
+        return DecompressBlock(block.data, block.raw_size).substr(location.offset, location.length);
+    }
+    return block.data.substr(location.offset, location.length);
+}
+
+void DocumentStore::Remove(const Location& location) {
+    if (mode_ == TextStorageMode::NONE) {
+        return;
+    }
+    Block& block = blocks_.at(location.block);
+    block.live_bytes -= location.length;
+    if (block.live_bytes == 0 && block.sealed) {
+        stored_bytes_ -= block.data.capacity();
+        std::string().swap(block.data);
+    }
+}
+
+size_t DocumentStore::GetStoredBytes() const {
+    return stored_bytes_;
+}
+
+void DocumentStore::Compact(const std::vector<Location*>& locations) {
+    if (mode_ == TextStorageMode::NONE) {
+        return;
+    }
+
+    std::vector<Location*> sorted = locations;
+    std::sort(sorted.begin(), sorted.end(), [](const Location* lhs, const Location* rhs) {
+        return lhs->block != rhs->block ? lhs->block < rhs->block : lhs->offset < rhs->offset;
+    });
+
+    DocumentStore compacted(mode_);
+    //Каждый старый блок распаковывается один раз
+    Reader reader(*this);
+    for (Location* location : sorted) {
+        *location = compacted.Add(reader.Get(*location));
+    }
+    *this = std::move(compacted);
+}
+
+void DocumentStore::SealLastBlock() {
+    Block& block = blocks_.back();
+    block.sealed = true;
+    stored_bytes_ -= block.data.capacity();
+    if (block.live_bytes == 0) {
+        std::string().swap(block.data);
+        return;
+    }
+    if (mode_ == TextStorageMode::COMPRESSED) {
+        std::string compressed = CompressBlock(block.data);
+        //Несжимаемые данные оставляем как есть
+        if (compressed.size() < block.data.size()) {
+            block.data = std::move(compressed);
+            block.compressed = true;
+        }
+    }
+    block.data.shrink_to_fit();
+    stored_bytes_ += block.data.capacity();
+}
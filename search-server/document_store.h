@@ -0,0 +1,74 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class TextStorageMode {
+    PLAIN,       //Тексты хранятся подряд в больших блоках
+    COMPRESSED,  //Заполненные блоки сжимаются, распаковка по запросу
+    NONE,        //Тексты не хранятся, остаётся только индекс
+};
+
+//Хранилище текстов документов. Тексты складываются подряд в блоки по BLOCK_SIZE байт,
+//заполненный блок в режиме COMPRESSED сжимается LZ-кодом в духе LZ4.
+class DocumentStore {
+public:
+    //Где лежит текст документа
+    struct Location {
+        uint32_t block = 0;
+        uint32_t offset = 0;
+        uint32_t length = 0;
+    };
+
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    explicit DocumentStore(TextStorageMode mode = TextStorageMode::PLAIN);
+
+    TextStorageMode GetMode() const;
+
+    //Чтение многих текстов подряд: последний распакованный блок запоминается, так что тексты,
+    //идущие по порядку блоков, распаковывают каждый блок один раз. Хранилище не меняется, пока Reader жив
+    class Reader {
+    public:
+        explicit Reader(const DocumentStore& store);
+
+        //Ссылка действительна до следующего вызова Get
+        std::string_view Get(const Location& location);
+
+    private:
+        const DocumentStore& store_;
+        std::string raw_block_;
+        size_t raw_block_index_;
+    };
+
+    Location Add(const std::string_view text);
+    //Распаковывает весь блок текста; для многих текстов подряд — Reader
+    std::string Get(const Location& location) const;
+    //Блок, в котором не осталось живых текстов, освобождается
+    void Remove(const Location& location);
+
+    //Байты, занятые блоками (сжатыми или нет)
+    size_t GetStoredBytes() const;
+
+    //Переупаковка только живых текстов; locations — все живые тексты, их положение обновляется
+    void Compact(const std::vector<Location*>& locations);
+
+private:
+    struct Block {
+        std::string data;
+        size_t raw_size = 0;
+        size_t live_bytes = 0;
+        bool compressed = false;
+        bool sealed = false;
+    };
+
+    TextStorageMode mode_;
+    std::vector<Block> blocks_;
+    size_t stored_bytes_ = 0;
+
+    void SealLastBlock();
+};
+
+std::string CompressBlock(const std::string_view data);
+std::string DecompressBlock(const std::string_view data, size_t raw_size);
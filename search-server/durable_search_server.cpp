@@ -0,0 +1,276 @@
+#include "durable_search_server.h"
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <system_error>
+#include <fcntl.h>
+#include <unistd.h>
+
+//Формат записей журнала:
+//  "<номер> A <запись документа, см. DocumentRecord>"
+//  "<номер> R <id>"
+namespace {
+
+const char ADD_OPERATION = 'A';
+const char REMOVE_OPERATION = 'R';
+
+uint64_t ParseOperationNumber(std::string_view& line) {
+    uint64_t value = 0;
+    const auto [ptr, error] = std::from_chars(line.data(), line.data() + line.size(), value);
+    if (error != std::errc() || ptr == line.data() + line.size() || *ptr != ' ') {
+        throw std::invalid_argument("Corrupted write-ahead log record");
+    }
+    line.remove_prefix(ptr - line.data() + 1);
+    return value;
+}
+
+void AppendOperationNumber(std::string& output, uint64_t value, char operation) {
+    char buffer[24];
+    const auto [end, _] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    output.append(buffer, end);
+    output.push_back(' ');
+    output.push_back(operation);
+    output.push_back(' ');
+}
+
+void SyncPath(const std::string& path, int flags) {
+    const int fd = open(path.c_str(), flags | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "Cannot open " + path);
+    }
+    const int result = fsync(fd);
+    const int error = errno;
+    close(fd);
+    if (result != 0) {
+        throw std::system_error(error, std::generic_category(), "Cannot sync " + path);
+    }
+}
+
+}  // namespace
+
+DurableSearchServer::DurableSearchServer(const std::string_view stop_words_text, const std::string& directory, const SearchServerOptions& options)
+    : directory_(directory)
+    , server_(stop_words_text, options)
+    , log_(directory + "/wal")
+{
+    if (options.text_storage == TextStorageMode::NONE) {
+        throw std::invalid_argument("Write-ahead log needs stored document texts for checkpoints");
+    }
+    Recover();
+}
+
+void DurableSearchServer::Recover() {
+    uint64_t checkpoint_operation = 0;
+    std::ifstream checkpoint(directory_ + "/checkpoint");
+    if (checkpoint) {
+        if (!(checkpoint >> checkpoint_operation)) {
+            throw std::invalid_argument("Corrupted checkpoint in " + directory_);
+        }
+        checkpoint.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        LoadDocuments(checkpoint, server_);
+    }
+    last_operation_ = checkpoint_operation;
+
+    DocumentRecord record;
+    size_t line_number = 0;
+    log_.Replay([&](std::string_view line) {
+        ++line_number;
+        const uint64_t operation = ParseOperationNumber(line);
+        if (line.size() < 2 || line[1] != ' ') {
+            throw std::invalid_argument("Corrupted write-ahead log record at line " + std::to_string(line_number));
+        }
+        const char type = line[0];
+        line.remove_prefix(2);
+        //Снимок записан, но журнал не успели очистить: эти операции уже в снимке
+        if (operation <= checkpoint_operation) {
+            return;
+        }
+
+        if (type == ADD_OPERATION) {
+            ParseDocumentRecord(line, line_number, record);
+            server_.AddDocument(record.id, record.text, record.status, record.ratings);
+        } else if (type == REMOVE_OPERATION) {
+            int document_id = 0;
+            const auto [ptr, error] = std::from_chars(line.data(), line.data() + line.size(), document_id);
+            if (error != std::errc() || ptr != line.data() + line.size()) {
+                throw std::invalid_argument("Corrupted write-ahead log record at line " + std::to_string(line_number));
+            }
+            server_.RemoveDocument(document_id);
+        } else {
+            throw std::invalid_argument("Unknown write-ahead log operation at line " + std::to_string(line_number));
+        }
+        last_operation_ = operation;
+    });
+    last_applied_ = last_operation_;
+}
+
+void DurableSearchServer::CheckAdd(int document_id, const std::string_view document) const {
+    const auto pending = pending_ids_.find(document_id);
+    const bool present = pending != pending_ids_.end() ? pending->second.present : server_.HasDocument(document_id);
+    if (document_id < 0 || present) {
+        throw std::invalid_argument("Invalid document_id");
+    }
+    SearchServer::CheckDocumentText(document);
+}
+
+uint64_t DurableSearchServer::LogAdd(int document_id, const std::string_view document, DocumentStatus status, const std::vector<int>& ratings) {
+    //В журнал попадают только операции, которые сервер примет
+    CheckAdd(document_id, document);
+    record_.clear();
+    AppendOperationNumber(record_, last_operation_ + 1, ADD_OPERATION);
+    AppendDocumentRecord(record_, document_id, status, ratings, document);
+    const uint64_t sequence = log_.Append(record_);
+    pending_ids_[document_id] = {true, ++last_operation_};
+    return sequence;
+}
+
+uint64_t DurableSearchServer::LogRemove(int document_id) {
+    record_.clear();
+    AppendOperationNumber(record_, last_operation_ + 1, REMOVE_OPERATION);
+    record_ += std::to_string(document_id);
+    const uint64_t sequence = log_.Append(record_);
+    pending_ids_[document_id] = {false, ++last_operation_};
+    return sequence;
+}
+
+void DurableSearchServer::ReleasePending(int document_id, uint64_t operation) {
+    const auto pending = pending_ids_.find(document_id);
+    if (pending != pending_ids_.end() && pending->second.operation == operation) {
+        pending_ids_.erase(pending);
+    }
+}
+
+void DurableSearchServer::Commit(uint64_t sequence, uint64_t first_operation, uint64_t last_operation, const std::function<void(bool)>& apply) {
+    std::exception_ptr error;
+    try {
+        log_.Sync(sequence);
+    } catch (...) {
+        error = std::current_exception();
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    applied_.wait(lock, [this, first_operation] {
+        return last_applied_ + 1 == first_operation;
+    });
+    //Ошибка диска делает журнал непригодным, все следующие операции тоже не дойдут до диска
+    try {
+        apply(!error);
+    } catch (...) {
+        error = error ? error : std::current_exception();
+    }
+    last_applied_ = last_operation;
+    applied_.notify_all();
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void DurableSearchServer::AddDocument(int document_id, const std::string_view document, DocumentStatus status, const std::vector<int>& ratings) {
+    uint64_t sequence = 0;
+    uint64_t operation = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sequence = LogAdd(document_id, document, status, ratings);
+        operation = last_operation_;
+    }
+    Commit(sequence, operation, operation, [&](bool durable) {
+        ReleasePending(document_id, operation);
+        if (durable) {
+            server_.AddDocument(document_id, document, status, ratings);
+        }
+    });
+}
+
+void DurableSearchServer::AddDocuments(const std::vector<DocumentRecord>& documents) {
+    uint64_t sequence = 0;
+    uint64_t first_operation = 0;
+    size_t logged_count = 0;
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        first_operation = last_operation_ + 1;
+        try {
+            for (const auto& document : documents) {
+                sequence = LogAdd(document.id, document.text, document.status, document.ratings);
+                ++logged_count;
+            }
+        } catch (...) {
+            error = std::current_exception();
+        }
+    }
+    //Документы до ошибочного записаны в журнал, они должны дойти до диска и попасть в сервер
+    if (logged_count > 0) {
+        Commit(sequence, first_operation, first_operation + logged_count - 1, [&](bool durable) {
+            for (size_t i = 0; i < logged_count; ++i) {
+                ReleasePending(documents[i].id, first_operation + i);
+            }
+            for (size_t i = 0; durable && i < logged_count; ++i) {
+                const auto& document = documents[i];
+                server_.AddDocument(document.id, document.text, document.status, document.ratings);
+            }
+        });
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void DurableSearchServer::RemoveDocument(int document_id) {
+    uint64_t sequence = 0;
+    uint64_t operation = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sequence = LogRemove(document_id);
+        operation = last_operation_;
+    }
+    Commit(sequence, operation, operation, [&](bool durable) {
+        ReleasePending(document_id, operation);
+        if (durable) {
+            server_.RemoveDocument(document_id);
+        }
+    });
+}
+
+void DurableSearchServer::Checkpoint() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    //В снимок входят все операции до last_operation_, поэтому ждём, пока они применятся
+    applied_.wait(lock, [this] {
+        return last_applied_ == last_operation_;
+    });
+    const std::string path = directory_ + "/checkpoint";
+    const std::string temporary_path = path + ".tmp";
+    {
+        std::ofstream output(temporary_path, std::ios::trunc);
+        output << last_operation_ << '\n';
+        std::vector<int> ratings(1);
+        //В порядке хранения текстов: в режиме COMPRESSED каждый блок распаковывается один раз
+        server_.ForEachDocumentText([&](int document_id, std::string_view text) {
+            //Средний рейтинг из одного значения равен ему самому
+            ratings[0] = server_.GetDocumentRating(document_id);
+            record_.clear();
+            AppendDocumentRecord(record_, document_id, server_.GetDocumentStatus(document_id), ratings, text);
+            record_.push_back('\n');
+            output << record_;
+        });
+        output.close();
+        if (!output) {
+            throw std::runtime_error("Cannot write checkpoint " + temporary_path);
+        }
+    }
+    SyncPath(temporary_path, O_RDONLY);
+    if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+        throw std::system_error(errno, std::generic_category(), "Cannot replace checkpoint " + path);
+    }
+    SyncPath(directory_, O_RDONLY | O_DIRECTORY);
+
+    //Снимок на диске, операции из журнала больше не нужны
+    log_.Truncate();
+}
+
+const SearchServer& DurableSearchServer::GetServer() const {
+    return server_;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "read_input_functions.h"
+#include "search_server.h"
+#include "write_ahead_log.h"
+
+//SearchServer с журналом изменений на диске. В каталоге directory лежат снимок (checkpoint)
+//и журнал (wal); при создании загружается снимок и поверх него проигрывается журнал.
+//Изменение проверяется, пишется в журнал и применяется к серверу, только когда запись дошла до диска:
+//при ошибке диска сервер остаётся без него. Изменять можно из нескольких потоков сразу, fsync у них общий. Поиск через GetServer — не одновременно с изменениями
+class DurableSearchServer {
+public:
+    DurableSearchServer(const std::string_view stop_words_text, const std::string& directory, const SearchServerOptions& options = {});
+
+    void AddDocument(int document_id, const std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+    //Пачка документов с одним ожиданием диска на всех
+    void AddDocuments(const std::vector<DocumentRecord>& documents);
+    void RemoveDocument(int document_id);
+
+    //Записывает снимок всех документов и очищает журнал
+    void Checkpoint();
+
+    const SearchServer& GetServer() const;
+
+private:
+    std::string directory_;
+    SearchServer server_;
+    WriteAheadLog log_;
+
+    //Есть ли документ после всех записанных, но ещё не применённых операций с этим id
+    struct PendingId {
+        bool present;
+        uint64_t operation;
+    };
+
+    //Порядок применения к серверу совпадает с порядком записей в журнале
+    std::mutex mutex_;
+    std::condition_variable applied_;
+    //Номер последней операции. Номера не сбрасываются при очистке журнала,
+    //в снимке хранится номер последней вошедшей в него операции
+    uint64_t last_operation_ = 0;
+    //Номер последней применённой к серверу (или отброшенной из-за ошибки диска) операции
+    uint64_t last_applied_ = 0;
+    std::map<int, PendingId> pending_ids_;
+    std::string record_;
+
+    void Recover();
+    //Проверяет добавление с учётом ждущих операций, как это сделал бы AddDocument сервера
+    void CheckAdd(int document_id, const std::string_view document) const;
+    uint64_t LogAdd(int document_id, const std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+    uint64_t LogRemove(int document_id);
+    //Ждёт диска для записей до sequence, затем в очередь за предыдущими вызывает apply для операций
+    //[first_operation, last_operation]. apply(false) — запись не дошла до диска, операции не применять;
+    //ошибка диска затем пробрасывается
+    void Commit(uint64_t sequence, uint64_t first_operation, uint64_t last_operation, const std::function<void(bool)>& apply);
+    void ReleasePending(int document_id, uint64_t operation);
+};
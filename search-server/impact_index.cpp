@@ -0,0 +1,98 @@
+#include "impact_index.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+//Соседние корзины отличаются по частоте примерно в sqrt(2) раз
+int QuantizeImpact(double term_freq) {
+    return static_cast<int>(std::floor(std::log2(term_freq) * 2));
+}
+
+}  // namespace
+
+void ImpactIndex::MarkDirty(const std::string_view word) {
+    dirty_words_.insert(word);
+    dirty_.store(true, std::memory_order_release);
+}
+
+void ImpactIndex::Erase(const std::string_view word) {
+    dirty_words_.erase(word);
+    EraseList(word);
+}
+
+void ImpactIndex::Refresh(const WordToDocumentFreqs& word_to_document_freqs) {
+    if (!dirty_.load(std::memory_order_acquire)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!dirty_.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    for (const std::string_view word : dirty_words_) {
+        const auto postings = word_to_document_freqs.find(word);
+        if (postings == word_to_document_freqs.end() || postings->second.size() < IMPACT_MIN_POSTINGS) {
+            EraseList(word);
+        } else {
+            EraseList(word);
+            List& list = lists_[postings->first] = BuildList(postings->second);
+            bytes_.fetch_add(GetListBytes(list), std::memory_order_relaxed);
+        }
+    }
+    dirty_words_.clear();
+    dirty_.store(false, std::memory_order_release);
+}
+
+const ImpactIndex::List* ImpactIndex::Find(const std::string_view word) const {
+    const auto it = lists_.find(word);
+    return it == lists_.end() ? nullptr : &it->second;
+}
+
+size_t ImpactIndex::GetPostingCount() const {
+    size_t count = 0;
+    for (const auto& [_, list] : lists_) {
+        count += list.postings.size();
+    }
+    return count;
+}
+
+size_t ImpactIndex::GetByteCount() const {
+    return bytes_.load(std::memory_order_relaxed);
+}
+
+void ImpactIndex::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lists_.clear();
+    bytes_.store(0, std::memory_order_relaxed);
+    dirty_words_.clear();
+    dirty_.store(false, std::memory_order_release);
+}
+
+size_t ImpactIndex::GetListBytes(const List& list) {
+    return list.postings.capacity() * sizeof(list.postings[0]) + list.bucket_ends.capacity() * sizeof(size_t);
+}
+
+void ImpactIndex::EraseList(const std::string_view word) {
+    const auto it = lists_.find(word);
+    if (it != lists_.end()) {
+        bytes_.fetch_sub(GetListBytes(it->second), std::memory_order_relaxed);
+        lists_.erase(it);
+    }
+}
+
+ImpactIndex::List ImpactIndex::BuildList(const DocumentFreqs& postings) {
+    List list;
+    list.postings.assign(postings.begin(), postings.end());
+    std::stable_sort(list.postings.begin(), list.postings.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.second > rhs.second;
+    });
+
+    for (size_t i = 1; i < list.postings.size(); ++i) {
+        if (QuantizeImpact(list.postings[i].second) != QuantizeImpact(list.postings[i - 1].second)) {
+            list.bucket_ends.push_back(i);
+        }
+    }
+    list.bucket_ends.push_back(list.postings.size());
+    return list;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "index_types.h"
+
+//Списки короче этого обходятся целиком, для них копия по убыванию частоты не строится
+const size_t IMPACT_MIN_POSTINGS = 128;
+
+//Копии длинных списков документов, отсортированные по убыванию частоты слова.
+//Документы разбиты на корзины с одинаковой округлённой (по логарифму) частотой,
+//первая частота корзины — верхняя граница для всех остальных в ней и в следующих корзинах.
+class ImpactIndex {
+public:
+    struct List {
+        std::vector<std::pair<int, double>> postings;
+        //Конец каждой корзины в postings
+        std::vector<size_t> bucket_ends;
+    };
+
+    void MarkDirty(const std::string_view word);
+    //Слово удаляется из индекса, ссылку на него хранить больше нельзя
+    void Erase(const std::string_view word);
+
+    //Перестраивает списки изменённых слов. Вызывается из поиска, в том числе из нескольких потоков сразу,
+    //но не одновременно с изменением индекса
+    void Refresh(const WordToDocumentFreqs& word_to_document_freqs);
+
+    const List* Find(const std::string_view word) const;
+
+    size_t GetPostingCount() const;
+    size_t GetByteCount() const;
+
+    //Сброс всех списков ради памяти; поиск обходит слова целиком, пока их не изменят снова
+    void Clear();
+
+private:
+    std::map<std::string_view, List> lists_;
+    std::set<std::string_view> dirty_words_;
+    std::atomic<bool> dirty_{false};
+    std::atomic<size_t> bytes_{0};
+    std::mutex mutex_;
+
+    static List BuildList(const DocumentFreqs& postings);
+    static size_t GetListBytes(const List& list);
+    void EraseList(const std::string_view word);
+};
@@ -0,0 +1,10 @@
+#pragma once
+#include <string_view>
+#include "counting_allocator.h"
+
+//Документы со словом и частота слова в каждом из них
+using DocumentFreqs = CountedMap<int, double>;
+//Обратный индекс: слово -> документы
+using WordToDocumentFreqs = CountedNestedMap<std::string_view, int, double>;
+//Прямой индекс: документ -> слова
+using DocumentToWordFreqs = CountedNestedMap<int, std::string_view, double>;
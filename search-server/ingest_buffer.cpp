@@ -0,0 +1,130 @@
+#include "ingest_buffer.h"
+#include <algorithm>
+#include <functional>
+#include <iterator>
+
+IngestBuffer::IngestBuffer() {
+    for (auto& chunk : chunks_) {
+        chunk.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+IngestBuffer::~IngestBuffer() {
+    for (auto& chunk : chunks_) {
+        delete[] chunk.load(std::memory_order_relaxed);
+    }
+}
+
+std::shared_mutex& IngestBuffer::GetPublishMutex() {
+    return publish_mutex_;
+}
+
+bool IngestBuffer::ClaimId(int document_id) {
+    IdStripe& stripe = id_stripes_[static_cast<size_t>(document_id) % STRIPE_COUNT];
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    return stripe.ids.insert(document_id).second;
+}
+
+void IngestBuffer::ReleaseId(int document_id) {
+    IdStripe& stripe = id_stripes_[static_cast<size_t>(document_id) % STRIPE_COUNT];
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    stripe.ids.erase(document_id);
+}
+
+bool IngestBuffer::IsClaimed(int document_id) {
+    IdStripe& stripe = id_stripes_[static_cast<size_t>(document_id) % STRIPE_COUNT];
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    return stripe.ids.count(document_id) > 0;
+}
+
+std::pair<uint32_t, IngestBuffer::StagedDocument*> IngestBuffer::AllocateSlot() {
+    //Кусок выделяется до того, как место занято: если new бросит, счётчик мест не сдвинется
+    uint32_t slot = slot_count_.load(std::memory_order_relaxed);
+    while (true) {
+        const size_t chunk = GetChunkIndex(slot);
+        StagedDocument* documents = GetChunk(chunk);
+        if (slot_count_.compare_exchange_weak(slot, slot + 1, std::memory_order_relaxed)) {
+            return {slot, documents + (slot - GetChunkBegin(chunk))};
+        }
+    }
+}
+
+void IngestBuffer::AddPostings(uint32_t slot, StagedDocument& document) {
+    size_t added = 0;
+    try {
+        for (const auto& [word, term_freq] : document.word_freqs) {
+            TermStripe& stripe = term_stripes_[std::hash<std::string_view>()(word) % STRIPE_COUNT];
+            std::lock_guard<std::mutex> lock(stripe.mutex);
+            stripe.postings[word].push_back({slot, term_freq});
+            ++added;
+        }
+    } catch (...) {
+        //Другие писатели могли дописать после нас, поэтому запись ищется с конца
+        for (size_t i = 0; i < added; ++i) {
+            const std::string_view word = document.word_freqs[i].first;
+            TermStripe& stripe = term_stripes_[std::hash<std::string_view>()(word) % STRIPE_COUNT];
+            std::lock_guard<std::mutex> lock(stripe.mutex);
+            auto& postings = stripe.postings.find(word)->second;
+            const auto it = std::find_if(postings.rbegin(), postings.rend(), [slot](const Posting& posting) { return posting.slot == slot; });
+            postings.erase(std::next(it).base());
+        }
+        document.discarded = true;
+        throw;
+    }
+}
+
+size_t IngestBuffer::GetDocumentCount() const {
+    return slot_count_.load(std::memory_order_relaxed);
+}
+
+const IngestBuffer::StagedDocument& IngestBuffer::GetDocument(uint32_t slot) const {
+    const size_t chunk = GetChunkIndex(slot);
+    return chunks_[chunk].load(std::memory_order_acquire)[slot - GetChunkBegin(chunk)];
+}
+
+void IngestBuffer::Clear() {
+    //Куски остаются для следующей партии, освобождаются только тексты, слова и позиции
+    const uint32_t count = slot_count_.load(std::memory_order_relaxed);
+    for (uint32_t slot = 0; slot < count; ++slot) {
+        const size_t chunk = GetChunkIndex(slot);
+        StagedDocument& document = chunks_[chunk].load(std::memory_order_relaxed)[slot - GetChunkBegin(chunk)];
+        document.text = std::string();
+        document.word_freqs = {};
+        document.positions = std::string();
+        document.discarded = false;
+    }
+    slot_count_.store(0, std::memory_order_relaxed);
+
+    for (auto& stripe : term_stripes_) {
+        stripe.postings.clear();
+    }
+    for (auto& stripe : id_stripes_) {
+        stripe.ids.clear();
+    }
+}
+
+size_t IngestBuffer::GetChunkIndex(uint32_t slot) {
+    size_t chunk = 0;
+    while (slot >= GetChunkBegin(chunk + 1)) {
+        ++chunk;
+    }
+    return chunk;
+}
+
+size_t IngestBuffer::GetChunkBegin(size_t chunk) {
+    return FIRST_CHUNK_SIZE * ((size_t{1} << chunk) - 1);
+}
+
+IngestBuffer::StagedDocument* IngestBuffer::GetChunk(size_t chunk) {
+    StagedDocument* documents = chunks_[chunk].load(std::memory_order_acquire);
+    if (documents != nullptr) {
+        return documents;
+    }
+    //Кусок выделяет первый дошедший до него писатель, проигравшие освобождают свой
+    auto* allocated = new StagedDocument[FIRST_CHUNK_SIZE << chunk];
+    if (chunks_[chunk].compare_exchange_strong(documents, allocated, std::memory_order_acq_rel)) {
+        return allocated;
+    }
+    delete[] allocated;
+    return documents;
+}
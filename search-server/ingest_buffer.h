@@ -0,0 +1,99 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "document.h"
+
+//Документы, добавленные из многих потоков и ещё не перенесённые в индекс.
+//Место под документ выделяется атомарным счётчиком, записи по словам дописываются в полосы
+//хеш-таблицы, у каждой полосы свой мьютекс, поэтому писатели почти не мешают друг другу
+class IngestBuffer {
+public:
+    struct StagedDocument {
+        int id = 0;
+        int rating = 0;
+        DocumentStatus status = DocumentStatus::ACTUAL;
+        std::string text;
+        //Частоты слов по возрастанию слова, слова ссылаются в text
+        std::vector<std::pair<std::string_view, double>> word_freqs;
+        //Поток позиций для PositionIndex, пустой без positional_index
+        std::string positions;
+        //Добавление не удалось, место пропускается при переносе в индекс
+        bool discarded = false;
+    };
+
+    struct Posting {
+        uint32_t slot;
+        double term_freq;
+    };
+
+    IngestBuffer();
+    ~IngestBuffer();
+
+    IngestBuffer(const IngestBuffer&) = delete;
+    IngestBuffer& operator=(const IngestBuffer&) = delete;
+
+    //Писатели держат разделяемую блокировку, перенос в индекс — исключительную
+    std::shared_mutex& GetPublishMutex();
+
+    //false, если id уже занят другим ожидающим документом
+    bool ClaimId(int document_id);
+    //Освобождает id добавления, которое не удалось
+    void ReleaseId(int document_id);
+    //Ждёт ли id публикации; для обычного AddDocument, который идёт не вместе с параллельными
+    bool IsClaimed(int document_id);
+    //Новое место под документ, адрес не меняется до Clear. Если бросает, место не выделено
+    std::pair<uint32_t, StagedDocument*> AllocateSlot();
+    //Если бросает, уже дописанные записи места убраны, а само место помечено discarded
+    void AddPostings(uint32_t slot, StagedDocument& document);
+
+    //Дальше — только под исключительной блокировкой.
+    //Число мест, включая помеченные discarded
+    size_t GetDocumentCount() const;
+    const StagedDocument& GetDocument(uint32_t slot) const;
+
+    template <typename Function>
+    void ForEachTerm(Function function) const {
+        for (const auto& stripe : term_stripes_) {
+            for (const auto& [word, postings] : stripe.postings) {
+                function(word, postings);
+            }
+        }
+    }
+
+    void Clear();
+
+private:
+    static constexpr size_t STRIPE_COUNT = 64;
+    //Куски мест удваиваются: 1024, 2048, ... — 32 кусков хватает на любое uint32_t
+    static constexpr size_t FIRST_CHUNK_SIZE = 1024;
+    static constexpr size_t MAX_CHUNK_COUNT = 32;
+
+    struct TermStripe {
+        std::mutex mutex;
+        std::unordered_map<std::string_view, std::vector<Posting>> postings;
+    };
+
+    struct IdStripe {
+        std::mutex mutex;
+        std::unordered_set<int> ids;
+    };
+
+    std::shared_mutex publish_mutex_;
+    std::array<TermStripe, STRIPE_COUNT> term_stripes_;
+    std::array<IdStripe, STRIPE_COUNT> id_stripes_;
+    std::atomic<uint32_t> slot_count_{0};
+    std::array<std::atomic<StagedDocument*>, MAX_CHUNK_COUNT> chunks_;
+
+    static size_t GetChunkIndex(uint32_t slot);
+    static size_t GetChunkBegin(size_t chunk);
+    StagedDocument* GetChunk(size_t chunk);
+};
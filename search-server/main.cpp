@@ -1,11 +1,58 @@
+#include "concurrent_map.h"
+#include "durable_search_server.h"
 #include "search_server.h"
+#include "sharded_search_server.h"
 #include "log_duration.h"
+#include "read_input_functions.h"
+#include "request_scheduler.h"
+#include "scoring_kernel.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <execution>
+#include <filesystem>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <set>
 #include <random>
+#include <sstream>
+#include <stdexcept>
 #include <string>
 #include <vector>
+#include <csignal>
+#include <cstdlib>
+#include <new>
+#include <system_error>
+#include <sys/resource.h>
 using namespace std;
+//Сколько ещё выделений памяти в этом потоке пройдёт до bad_alloc, -1 — без ограничения
+thread_local int allocations_until_failure = -1;
+void* operator new(size_t size) {
+    if (allocations_until_failure == 0) {
+        throw bad_alloc();
+    }
+    if (allocations_until_failure > 0) {
+        --allocations_until_failure;
+    }
+    if (void* memory = malloc(size == 0 ? 1 : size)) {
+        return memory;
+    }
+    throw bad_alloc();
+}
+void* operator new(size_t size, const nothrow_t&) noexcept {
+    return malloc(size == 0 ? 1 : size);
+}
+//Без встраивания: GCC принимает free после встроенного new за несовпадающую пару
+[[gnu::noinline]] void operator delete(void* memory) noexcept {
+    free(memory);
+}
+[[gnu::noinline]] void operator delete(void* memory, size_t) noexcept {
+    free(memory);
+}
 string GenerateWord(mt19937& generator, int max_length) {
     const int length = uniform_int_distribution(1, max_length)(generator);
     string word;
@@ -57,7 +104,1009 @@ void Test(string_view mark, const SearchServer& search_server, const vector<stri
     cout << total_relevance << endl;
 }
 #define TEST(policy) Test(#policy, search_server, queries, execution::policy)
+//Топы двух серверов совпадают по релевантности и рейтингу (порядок равных документов не важен)
+void CheckSameTop(string_view mark, const vector<Document>& expected, const vector<Document>& actual) {
+    const auto differs = [](const Document& lhs, const Document& rhs) {
+        return abs(lhs.relevance - rhs.relevance) > 1e-9 || lhs.rating != rhs.rating;
+    };
+    if (expected.size() != actual.size() || !equal(expected.begin(), expected.end(), actual.begin(), [&](const auto& lhs, const auto& rhs) {
+            return !differs(lhs, rhs);
+        })) {
+        throw logic_error("Check failed: "s + string(mark));
+    }
+}
+//Топы совпадают вместе с id документов и их порядком
+void CheckSameIds(string_view mark, const vector<Document>& expected, const vector<Document>& actual) {
+    CheckSameTop(mark, expected, actual);
+    if (!equal(expected.begin(), expected.end(), actual.begin(), actual.end(), [](const Document& lhs, const Document& rhs) {
+            return lhs.id == rhs.id;
+        })) {
+        throw logic_error("Check failed: ids of "s + string(mark));
+    }
+}
+//Поиск по корзинам не теряет документы, совпавшие только со словами с нулевым IDF
+void CheckImpactOrderedPostings() {
+    SearchServerOptions options;
+    options.impact_ordered_postings = true;
+    SearchServer plain(""s), impact(""s, options);
+    for (int id = 0; id < 300; ++id) {
+        const string text = "common w"s + to_string(id % 7) + (id % 3 == 0 ? " rare"s : ""s);
+        plain.AddDocument(id, text, DocumentStatus::ACTUAL, {id % 5});
+        impact.AddDocument(id, text, DocumentStatus::ACTUAL, {id % 5});
+    }
+    for (const string_view query : {"common"sv, "common -w3"sv, "common w2"sv, "common rare -w1"sv, "w1 w2"sv}) {
+        CheckSameTop(query, plain.FindTopDocuments(query), impact.FindTopDocuments(query));
+        CheckSameTop(query, plain.FindTopDocuments<100>(execution::seq, query, AnyDocument{}),
+                     impact.FindTopDocuments<100>(execution::seq, query, AnyDocument{}));
+    }
+}
+//Минус-префикс исключает документы со всеми словами с этим началом, сколько бы их ни было
+void CheckMinusPrefix() {
+    SearchServer search_server(""s);
+    for (int id = 0; id < 1100; ++id) {
+        search_server.AddDocument(id, "y x"s + to_string(id) + (id < 100 ? " x0"s : ""s), DocumentStatus::ACTUAL, {1});
+    }
+    search_server.AddDocument(2000, "y z"s, DocumentStatus::ACTUAL, {1});
+    const auto found = search_server.FindTopDocuments("y -x*"sv);
+    if (found.size() != 1 || found[0].id != 2000 || !get<0>(search_server.MatchDocument("y -x*"sv, 104)).empty()) {
+        throw logic_error("Check failed: y -x*"s);
+    }
+}
+//Плюс-префикс сверх MAX_PREFIX_EXPANSIONS совпадает только с оставленными словами во всех путях поиска и проверки
+void CheckPrefixCap() {
+    SearchServer search_server(""s);
+    //pre0..pre1023 встречаются в трёх документах, pre1024..pre1099 — в одном-двух, поэтому остаются первые
+    for (int word = 0; word < 1100; ++word) {
+        for (int copy = 0; copy < (word < 1024 ? 3 : 1); ++copy) {
+            search_server.AddDocument(word * 3 + copy, "pre"s + to_string(word), DocumentStatus::ACTUAL, {1});
+        }
+    }
+    search_server.AddDocument(5000, "pre1099 other"s, DocumentStatus::ACTUAL, {1});
+    search_server.AddDocument(5001, "pre5 pre1050 other"s, DocumentStatus::ACTUAL, {1});
+
+    for (const string_view query : {"pre*"sv, "pre* other"sv}) {
+        const auto found = search_server.FindTopDocuments<4000>(execution::seq, query, AnyDocument{});
+        const bool has_5000 = any_of(found.begin(), found.end(), [](const Document& document) { return document.id == 5000; });
+        if (found.size() != 3073u + (query == "pre* other"sv ? 1u : 0u) || has_5000 != (query == "pre* other"sv)) {
+            throw logic_error("Check failed: found over the prefix cap for "s + string(query));
+        }
+        const auto matched = search_server.MatchDocuments(query, {5000, 5001, 2100, 3150});
+        for (const auto& match : matched.documents) {
+            const vector<string_view> words(matched.words.begin() + match.words_begin,
+                                            matched.words.begin() + match.words_begin + match.words_count);
+            if (words != get<0>(search_server.MatchDocument(query, match.document_id))) {
+                throw logic_error("Check failed: MatchDocuments over the prefix cap for "s + string(query));
+            }
+        }
+    }
+    if (!get<0>(search_server.MatchDocument("pre*"sv, 5000)).empty()
+        || get<0>(search_server.MatchDocument("pre*"sv, 5001)) != vector<string_view>{"pre5"sv}
+        || get<0>(search_server.MatchDocument("pre* other"sv, 5000)) != vector<string_view>{"other"sv}
+        || get<0>(search_server.MatchDocument("pre*"sv, 2100)) != vector<string_view>{"pre700"sv}
+        || !get<0>(search_server.MatchDocument("pre*"sv, 3150)).empty()) {
+        throw logic_error("Check failed: MatchDocument over the prefix cap"s);
+    }
+}
+//Тексты после восстановления из журнала и из снимка совпадают побайтно
+void CheckDurableRecovery() {
+    const auto directory = filesystem::temp_directory_path() / ("search_server_check_"s + to_string(random_device()()));
+    filesystem::create_directories(directory);
+    const vector<string> texts = {"  leading space cat"s, "trailing space dog  "s, "inner   spaces  bird"s, " "s, ""s};
+    const auto check_texts = [&texts](const SearchServer& search_server) {
+        for (size_t id = 0; id < texts.size(); ++id) {
+            if (search_server.GetDocumentText(id) != texts[id]) {
+                throw logic_error("Check failed: recovered text of document "s + to_string(id));
+            }
+        }
+    };
+    {
+        DurableSearchServer durable("in"sv, directory.string());
+        for (size_t id = 0; id < texts.size(); ++id) {
+            durable.AddDocument(id, texts[id], DocumentStatus::ACTUAL, {1});
+        }
+    }
+    {
+        DurableSearchServer durable("in"sv, directory.string());
+        check_texts(durable.GetServer());
+        durable.Checkpoint();
+    }
+    check_texts(DurableSearchServer("in"sv, directory.string()).GetServer());
+    filesystem::remove_all(directory);
+}
+//Сервер с маленьким лимитом памяти уплотняется по ходу добавления, но находит и хранит то же, что сервер без лимита
+void CheckMemoryBudget() {
+    SearchServerOptions options;
+    options.text_storage = TextStorageMode::COMPRESSED;
+    options.impact_ordered_postings = true;
+    options.positional_index = true;
+    options.vectorized_scoring = true;
+    const auto fill = [](SearchServer& search_server) {
+        for (int id = 0; id < 6000; ++id) {
+            search_server.AddDocument(id, "white cat u"s + to_string(id) + " w"s + to_string(id % 6) + " x"s + to_string(id % 5),
+                                      DocumentStatus::ACTUAL, {id % 4});
+            if (id % 2 == 1 && id < 3000) {
+                search_server.RemoveDocument(id);
+            }
+            if (id % 1000 == 999) {
+                search_server.FindTopDocuments<5>(execution::seq, "cat w1"sv, AnyDocument{});
+            }
+        }
+    };
+    SearchServer expected("x0"s, options);
+    fill(expected);
+    options.memory_budget_bytes = 64 << 10;
+    SearchServer budgeted("x0"s, options);
+    fill(budgeted);
+
+    const MemoryStats expected_stats = expected.GetMemoryStats();
+    const MemoryStats budgeted_stats = budgeted.GetMemoryStats();
+    //Слова удалённых документов остаются в словаре до уплотнения
+    if (budgeted_stats.dictionary.entries >= expected_stats.dictionary.entries
+        || budgeted_stats.document_store.bytes >= expected_stats.document_store.bytes
+        || budgeted_stats.documents.entries != static_cast<size_t>(budgeted.GetDocumentCount())
+        || budgeted_stats.postings.entries != expected_stats.postings.entries
+        || budgeted_stats.forward_index.entries != expected_stats.forward_index.entries
+        || budgeted_stats.GetTotalBytes() >= expected_stats.GetTotalBytes()) {
+        throw logic_error("Check failed: memory budget did not compact"s);
+    }
+    for (const string_view query : {"cat"sv, "w1 x1 -w2"sv, "\"white cat\" w3"sv, "w* -x3"sv, "u2 u5000 u4001"sv}) {
+        CheckSameIds(query, expected.FindTopDocuments<20>(execution::seq, query, AnyDocument{}),
+                     budgeted.FindTopDocuments<20>(execution::seq, query, AnyDocument{}));
+        CheckSameIds(query, expected.FindTopDocuments<20>(execution::par, query, AnyDocument{}),
+                     budgeted.FindTopDocuments<20>(execution::par, query, AnyDocument{}));
+    }
+    for (int id = 0; id < 6000; id += 97) {
+        if (expected.HasDocument(id) != budgeted.HasDocument(id)
+            || (expected.HasDocument(id) && expected.GetDocumentText(id) != budgeted.GetDocumentText(id))) {
+            throw logic_error("Check failed: text after compaction of document "s + to_string(id));
+        }
+    }
+}
+//Записи длиннее нескольких блоков чтения: пустые строки и '\r' пропускаются, текст читается побайтно тем же.
+//Ошибка формата отдаёт обработчику всё, что было до неё, в том числе из того же блока
+void CheckReadDocuments() {
+    string input;
+    vector<string> texts;
+    for (int id = 0; id < 40'000; ++id) {
+        texts.push_back((id % 5 == 0 ? " cat  "s : "dog "s) + to_string(id) + string(id % 50, 'x'));
+        AppendDocumentRecord(input, id, static_cast<DocumentStatus>(id % 4), vector<int>(id % 3, id - 20'000), texts.back());
+        input += id % 7 == 0 ? "\r\n\n"s : "\n"s;
+    }
+    istringstream stream(input);
+    int next_id = 0;
+    ReadDocuments(stream, [&](const DocumentRecord& record) {
+        if (record.id != next_id || record.status != static_cast<DocumentStatus>(next_id % 4)
+            || record.ratings != vector<int>(next_id % 3, next_id - 20'000) || record.text != texts[next_id]) {
+            throw logic_error("Check failed: read record "s + to_string(next_id));
+        }
+        ++next_id;
+    });
+    if (next_id != static_cast<int>(texts.size())) {
+        throw logic_error("Check failed: read record count"s);
+    }
+
+    for (const size_t valid_count : {size_t{10}, size_t{30'000}}) {
+        string broken;
+        for (size_t id = 0; id < valid_count; ++id) {
+            AppendDocumentRecord(broken, id, DocumentStatus::ACTUAL, {1}, "cat "s + string(id % 50, 'x'));
+            broken += '\n';
+        }
+        broken += "oops\n5 0 0 dog\n"s;
+        istringstream broken_stream(broken);
+        SearchServer search_server(""s);
+        try {
+            LoadDocuments(broken_stream, search_server);
+            throw logic_error("Check failed: broken record accepted"s);
+        } catch (const invalid_argument& error) {
+            if (string(error.what()).find(to_string(valid_count + 1)) == string::npos) {
+                throw logic_error("Check failed: broken record line in "s + error.what());
+            }
+        }
+        if (search_server.GetDocumentCount() != static_cast<int>(valid_count)) {
+            throw logic_error("Check failed: records before a broken one, loaded "s + to_string(search_server.GetDocumentCount()));
+        }
+    }
+
+    istringstream load_stream(input);
+    SearchServer search_server(""s);
+    if (LoadDocuments(load_stream, search_server) != texts.size() || search_server.GetDocumentText(39'999) != texts.back()) {
+        throw logic_error("Check failed: loaded documents"s);
+    }
+}
+//Упакованный ключ упорядочивает так же, как RelevanceOrder, когда релевантности различаются хотя бы на DEAD_ZONE
+//или лежат в одной доле DEAD_ZONE. Расходятся они только у соседних долей, там решает релевантность
+void CheckPackedRelevanceOrder() {
+    const auto before = [](double lhs_relevance, int lhs_rating, double rhs_relevance, int rhs_rating) {
+        return PackedRelevanceOrder::Before({1, lhs_relevance, lhs_rating}, {2, rhs_relevance, rhs_rating});
+    };
+    const auto equal_keys = [](double lhs_relevance, int lhs_rating, double rhs_relevance, int rhs_rating) {
+        return PackedRelevanceOrder::Key({1, lhs_relevance, lhs_rating}) == PackedRelevanceOrder::Key({2, rhs_relevance, rhs_rating});
+    };
+    const double bucket = 1000 * DEAD_ZONE;
+    //Одна доля: решает рейтинг, в том числе отрицательный
+    if (!before(bucket + 0.25 * DEAD_ZONE, 3, bucket + 0.75 * DEAD_ZONE, -3) || !before(bucket + 0.75 * DEAD_ZONE, -3, bucket + 0.25 * DEAD_ZONE, -4)) {
+        throw logic_error("Check failed: packed order within a DEAD_ZONE bucket"s);
+    }
+    //Соседние доли ближе DEAD_ZONE: RelevanceOrder смотрит на рейтинг, упакованный ключ — на долю
+    if (!before(bucket + 0.1 * DEAD_ZONE, -100, bucket - 0.1 * DEAD_ZONE, 100)) {
+        throw logic_error("Check failed: packed order across a DEAD_ZONE boundary"s);
+    }
+    //Отрицательная релевантность как нулевая, очень большая упирается в 40 бит, рейтинги — в ±2^23
+    if (!equal_keys(-1.0, 5, 0.0, 5) || !before(0.0, 6, -1.0, 5) || !equal_keys(2e6, 1, 3e6, 1) || !before(2e6, 2, 3e6, 1)
+        || !before(1e5 + 1.0, 0, 1e5, 0) || !equal_keys(1.0, 1 << 23, 1.0, numeric_limits<int>::max())
+        || !equal_keys(1.0, -(1 << 23), 1.0, numeric_limits<int>::min()) || !before(1.0, (1 << 23) - 1, 1.0, (1 << 23) - 2)
+        || !before(1.0, -(1 << 23) + 1, 1.0, numeric_limits<int>::min())) {
+        throw logic_error("Check failed: packed order limits"s);
+    }
+
+    mt19937 generator(11);
+    for (int i = 0; i < 100'000; ++i) {
+        const Document lhs{1, uniform_real_distribution<double>(0.0, 50.0)(generator), uniform_int_distribution(-1000, 1000)(generator)};
+        Document rhs{2, lhs.relevance, uniform_int_distribution(-1000, 1000)(generator)};
+        rhs.relevance += i % 2 == 0 ? uniform_real_distribution<double>(-10 * DEAD_ZONE, 10 * DEAD_ZONE)(generator)
+                                    : uniform_real_distribution<double>(-1.0, 1.0)(generator);
+        const bool same_bucket = floor(lhs.relevance / DEAD_ZONE) == floor(rhs.relevance / DEAD_ZONE);
+        if ((same_bucket || abs(lhs.relevance - rhs.relevance) >= DEAD_ZONE)
+            && (PackedRelevanceOrder::Before(lhs, rhs) != RelevanceOrder::Before(lhs, rhs)
+                || PackedRelevanceOrder::Before(rhs, lhs) != RelevanceOrder::Before(rhs, lhs))) {
+            throw logic_error("Check failed: packed order disagrees at relevance "s + to_string(lhs.relevance));
+        }
+    }
+
+    //Релевантности этого сервера либо равны, либо различаются больше чем на DEAD_ZONE
+    SearchServer search_server(""s);
+    for (int id = 0; id < 500; ++id) {
+        search_server.AddDocument(id, "cat w"s + to_string(id % 7) + " x"s + to_string(id % 3), DocumentStatus::ACTUAL, {id % 11 - 5});
+    }
+    for (const string_view query : {"cat"sv, "w1 x2"sv, "w3 -x1"sv, "cat w5 x0"sv}) {
+        CheckSameIds(query, search_server.FindTopDocuments<5>(execution::seq, query, AnyDocument{}),
+                     search_server.FindTopDocuments<5, PackedRelevanceOrder>(execution::seq, query, AnyDocument{}));
+        CheckSameIds(query, search_server.FindTopDocuments<40>(execution::par, query, AnyDocument{}),
+                     search_server.FindTopDocuments<40, PackedRelevanceOrder>(execution::par, query, AnyDocument{}));
+    }
+}
+//Таблица стоп-слов строится при компиляции. "the" и "a" попадают в одну ячейку из 16,
+//"tta" и "ah" проходят отсев по длине и первому байту и доходят до той же цепочки проб. Повтор "the" не занимает ячейку
+constexpr StaticStopWordSet<8> STATIC_STOP_WORDS(std::array<std::string_view, 8>{"in"sv, "the"sv, "and"sv, "of"sv, "a"sv, "to"sv, "is"sv, "the"sv});
+static_assert((HashStopWord("the"sv) & 15) == (HashStopWord("a"sv) & 15) && (HashStopWord("tta"sv) & 15) == (HashStopWord("a"sv) & 15));
+static_assert(STATIC_STOP_WORDS.Contains("the"sv) && STATIC_STOP_WORDS.Contains("a"sv) && STATIC_STOP_WORDS.Contains("is"sv));
+static_assert(!STATIC_STOP_WORDS.Contains("tta"sv) && !STATIC_STOP_WORDS.Contains("ah"sv) && !STATIC_STOP_WORDS.Contains("th"sv)
+              && !STATIC_STOP_WORDS.Contains("on"sv) && !STATIC_STOP_WORDS.Contains(""sv));
+
+//Хеш-таблица стоп-слов отвечает так же, как std::set, в том числе на словах, проходящих отсев
+//по длине и первому байту, длиннее 63 байт и с первым байтом за пределами ASCII
+void CheckStopWords() {
+    mt19937 generator(3);
+    vector<string> stop_words = {"in"s, "the"s, "and"s, "a"s, "\xD0\xB8"s, string(63, 'l'), string(100, 'l'), "the"s, ""s};
+    for (int i = 0; i < 200; ++i) {
+        stop_words.push_back(GenerateWord(generator, 6));
+    }
+    const set<string> expected(stop_words.begin(), stop_words.end());
+    const StopWordSet actual(stop_words);
+
+    vector<string> probes = {""s, "th"s, "thee"s, "tta"s, "ah"s, "i"s, "\xD0\xB0"s, string(64, 'l'), string(99, 'l'), string(63, 'k')};
+    for (const string& word : stop_words) {
+        probes.push_back(word);
+        probes.push_back(word + "x"s);
+        if (!word.empty()) {
+            probes.push_back(word.substr(1));
+            probes.push_back("z"s + word.substr(1));
+        }
+    }
+    for (int i = 0; i < 20'000; ++i) {
+        probes.push_back(GenerateWord(generator, 7));
+    }
+    for (const string& word : probes) {
+        if (actual.Contains(word) != (!word.empty() && expected.count(word) > 0)) {
+            throw logic_error("Check failed: stop word "s + word);
+        }
+    }
+    if (actual.size() != expected.size() - 1) {
+        throw logic_error("Check failed: stop word count"s);
+    }
+
+    const StopWordSet from_static(STATIC_STOP_WORDS);
+    const set<string_view> expected_static(STATIC_STOP_WORDS.begin(), STATIC_STOP_WORDS.end());
+    for (const string_view word : {"in"sv, "the"sv, "a"sv, "on"sv, "tta"sv, "ah"sv, "th"sv, "an"sv, ""sv, "ont"sv}) {
+        if (from_static.Contains(word) != (expected_static.count(word) > 0) || STATIC_STOP_WORDS.Contains(word) != from_static.Contains(word)) {
+            throw logic_error("Check failed: static stop word "s + string(word));
+        }
+    }
+    if (from_static.size() != expected_static.size()) {
+        throw logic_error("Check failed: static stop word count"s);
+    }
+    SearchServer static_server(STATIC_STOP_WORDS), dynamic_server("in the and of a to is"s);
+    for (SearchServer* search_server : {&static_server, &dynamic_server}) {
+        search_server->AddDocument(1, "the cat in a hat"sv, DocumentStatus::ACTUAL, {1});
+        search_server->AddDocument(2, "tta ah on top"sv, DocumentStatus::ACTUAL, {1});
+    }
+    for (const string_view query : {"the cat"sv, "tta hat"sv, "ah -cat"sv, "top a"sv}) {
+        CheckSameIds(query, dynamic_server.FindTopDocuments(query), static_server.FindTopDocuments(query));
+        if (get<0>(static_server.MatchDocument(query, 2)) != get<0>(dynamic_server.MatchDocument(query, 2))) {
+            throw logic_error("Check failed: static stop words in "s + string(query));
+        }
+    }
+}
+//Оба плана выполнения дают один и тот же топ, а ExplainQuery описывает план известного запроса
+void CheckQueryPlans() {
+    SearchServer known(""s);
+    known.AddDocument(0, "cat dog common"sv, DocumentStatus::ACTUAL, {1});
+    known.AddDocument(1, "cat bird common"sv, DocumentStatus::ACTUAL, {1});
+    known.AddDocument(2, "cat common"sv, DocumentStatus::ACTUAL, {1});
+    known.AddDocument(3, "fish common"sv, DocumentStatus::ACTUAL, {1});
+    //Стоимость слово за словом: (3 + 1 + 1) * log2(4 + 2), по документам: 4 кандидата * 3 списка + 1
+    const string expected_plan = "term-at-a-time (cost 12.9248 term-at-a-time, 13 document-at-a-time), all documents match\n"
+                                 "  -bird documents=1 idf=1.38629\n"
+                                 "  -none documents=0 idf=0 dropped\n"
+                                 "  +cat documents=3 idf=0.287682\n"
+                                 "  +common documents=4 idf=0 dropped\n"
+                                 "  +fish documents=1 idf=1.38629"s;
+    ostringstream plan;
+    plan << known.ExplainQuery("cat fish common -bird -none"sv);
+    if (plan.str() != expected_plan) {
+        throw logic_error("Check failed: ExplainQuery printed\n"s + plan.str());
+    }
+
+    SearchServer search_server("and"s);
+    for (int id = 0; id < 3000; ++id) {
+        search_server.AddDocument(id, "cat and w"s + to_string(id % 17) + " x"s + to_string(id % 5) + " u"s + to_string(id % 300)
+                                      + (id % 100 == 0 ? " rare"s : ""s),
+                                  id % 9 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL, {id % 8});
+    }
+    const auto strategy_of = [&search_server](string_view query) {
+        return search_server.ExplainQuery(query).strategy;
+    };
+    //Оценка стоимости выбирает разные стратегии, так что и без принуждения работают оба пути
+    //Много коротких списков — слово за словом, мало длинных — по документам
+    const string_view short_lists = "u1 u2 u3 u4 u5 u6 u7 u8"sv;
+    if (strategy_of(short_lists) != SearchServer::QueryStrategy::TERM_AT_A_TIME || strategy_of("w3 x1 -x2"sv) != SearchServer::QueryStrategy::DOCUMENT_AT_A_TIME) {
+        throw logic_error("Check failed: planned strategies"s);
+    }
+    for (const string_view query : {"cat"sv, "rare w0"sv, "w3 x1 -x2"sv, "cat x1 w2 -w3"sv, "x* -w1"sv, "cat and"sv, "unknown -cat"sv, short_lists, "u1 u2 u3 -x1"sv}) {
+        vector<vector<Document>> tops;
+        for (const auto strategy : {SearchServer::QueryStrategy::TERM_AT_A_TIME, SearchServer::QueryStrategy::DOCUMENT_AT_A_TIME}) {
+            search_server.ForceQueryStrategy(strategy);
+            if (search_server.ExplainQuery(query).strategy != strategy) {
+                throw logic_error("Check failed: forced strategy of "s + string(query));
+            }
+            tops.push_back(search_server.FindTopDocuments<20>(execution::seq, query, AnyDocument{}));
+            tops.push_back(search_server.FindTopDocuments<20>(execution::par, query, AnyDocument{}));
+            tops.push_back(search_server.FindTopDocuments(execution::seq, query, [](int id, DocumentStatus, int rating) {
+                return id % 2 == 0 && rating > 2;
+            }));
+            tops.push_back(search_server.FindTopDocuments(execution::par, query, DocumentStatus::BANNED));
+        }
+        search_server.ForceQueryStrategy(nullopt);
+        for (size_t i = 0; i < tops.size() / 2; ++i) {
+            CheckSameIds(query, tops[i], tops[i + tops.size() / 2]);
+        }
+        CheckSameIds(query, search_server.FindTopDocuments<20>(execution::seq, query, AnyDocument{}), tops[0]);
+    }
+}
+//Пакетное удаление оставляет тот же индекс, что и удаление по одному, и тот же, что у сервера без этих
+//документов. Отсутствующие и повторные id пропускаются, опустевшие слова уходят из словаря
+void CheckBatchRemove() {
+    SearchServerOptions options;
+    options.impact_ordered_postings = true;
+    options.positional_index = true;
+    options.vectorized_scoring = true;
+    const auto text = [](int id) {
+        //Слово solo есть только у удаляемых документов с id, кратным 10
+        return "cat w"s + to_string(id % 11) + " x"s + to_string(id % 6) + (id % 10 == 0 ? " solo"s + to_string(id) : ""s);
+    };
+    const auto is_removed = [](int id) {
+        return id % 10 == 0 || id % 7 == 3;
+    };
+    vector<int> removed = {5000, -1, 3, 3};
+    SearchServer fresh(""s, options);
+    for (int id = 0; id < 1000; ++id) {
+        if (is_removed(id)) {
+            removed.push_back(id);
+        } else {
+            fresh.AddDocument(id, text(id), DocumentStatus::ACTUAL, {id % 5});
+        }
+    }
+    const auto fill = [&text](SearchServer& search_server) {
+        for (int id = 0; id < 1000; ++id) {
+            search_server.AddDocument(id, text(id), DocumentStatus::ACTUAL, {id % 5});
+        }
+        //Поиск строит кэши, которые удаление должно поправить
+        search_server.FindTopDocuments("cat w1"sv);
+    };
+    SearchServer one_by_one(""s, options), batch_seq(""s, options), batch_par(""s, options);
+    fill(one_by_one);
+    fill(batch_seq);
+    fill(batch_par);
+    for (const int id : removed) {
+        one_by_one.RemoveDocument(id);
+    }
+    batch_seq.RemoveDocuments(execution::seq, removed);
+    batch_par.RemoveDocuments(execution::par, removed);
+
+    //Удаление по одному оставляет пустые слова до уплотнения
+    one_by_one.CompactMemory();
+    const auto expected_stats = fresh.GetMemoryStats();
+    for (const SearchServer* search_server : {&one_by_one, &batch_seq, &batch_par}) {
+        const auto stats = search_server->GetMemoryStats();
+        if (search_server->GetDocumentCount() != fresh.GetDocumentCount() || stats.dictionary.entries != expected_stats.dictionary.entries
+            || stats.postings.entries != expected_stats.postings.entries || stats.forward_index.entries != expected_stats.forward_index.entries) {
+            throw logic_error("Check failed: index after RemoveDocuments"s);
+        }
+        for (const string_view query : {"cat"sv, "w3 x1"sv, "solo10 cat"sv, "solo*"sv, "w1 -x3"sv, "\"cat w2\""sv}) {
+            CheckSameIds(query, fresh.FindTopDocuments<50>(execution::seq, query, AnyDocument{}),
+                         search_server->FindTopDocuments<50>(execution::seq, query, AnyDocument{}));
+            if (get<0>(search_server->MatchDocument(query, 1)) != get<0>(fresh.MatchDocument(query, 1))) {
+                throw logic_error("Check failed: match after RemoveDocuments "s + string(query));
+            }
+        }
+        if (search_server->GetWordFrequencies(1) != fresh.GetWordFrequencies(1) || !search_server->GetWordFrequencies(10).empty()) {
+            throw logic_error("Check failed: forward index after RemoveDocuments"s);
+        }
+    }
+}
+//Фильтр по индексу находит то же, что и такой же предикат, на последовательном и параллельном пути,
+//в том числе когда фильтр отбирает мало документов и отбор идёт по колонке рейтингов или диапазону id
+void CheckDocumentFilter() {
+    SearchServerOptions options;
+    options.vectorized_scoring = true;
+    SearchServer plain("and"s), vectorized("and"s, options);
+    for (int id = 0; id < 2000; ++id) {
+        const string text = "cat and w"s + to_string(id % 13) + " x"s + to_string(id % 7) + (id % 50 == 0 ? " rare"s : ""s);
+        const DocumentStatus status = static_cast<DocumentStatus>(id % 7 == 0 ? id % 4 : 0);
+        plain.AddDocument(id, text, status, {(id * 37) % 101 - 50});
+        vectorized.AddDocument(id, text, status, {(id * 37) % 101 - 50});
+    }
+    const unsigned all_statuses = DocumentFilter::StatusBit(DocumentStatus::ACTUAL) | DocumentFilter::StatusBit(DocumentStatus::IRRELEVANT)
+                                  | DocumentFilter::StatusBit(DocumentStatus::BANNED) | DocumentFilter::StatusBit(DocumentStatus::REMOVED);
+    vector<DocumentFilter> filters(9);
+    filters[1].min_rating = 10;
+    filters[1].max_rating = 12;
+    filters[2].min_rating = -50;
+    filters[2].max_rating = 40;
+    filters[3].min_document_id = 100;
+    filters[3].max_document_id = 130;
+    filters[4].statuses = DocumentFilter::StatusBit(DocumentStatus::BANNED) | DocumentFilter::StatusBit(DocumentStatus::REMOVED);
+    filters[5].statuses = all_statuses;
+    filters[5].min_rating = 0;
+    filters[5].min_document_id = 1500;
+    filters[6].statuses = DocumentFilter::StatusBit(DocumentStatus::IRRELEVANT);
+    filters[6].min_rating = -5;
+    filters[6].max_rating = 5;
+    filters[7].min_rating = 5;
+    filters[7].max_rating = 4;
+    filters[8].statuses = all_statuses;
+
+    for (const string_view query : {"cat"sv, "w3 x1"sv, "cat -x2"sv, "rare w0"sv, "x*"sv, "nothing"sv}) {
+        for (const SearchServer* search_server : {&plain, &vectorized}) {
+            for (const DocumentFilter& filter : filters) {
+                const auto predicate = [&filter](int document_id, DocumentStatus status, int rating) {
+                    return filter.Matches(document_id, status, rating);
+                };
+                const auto expected = search_server->FindTopDocuments(execution::seq, query, predicate);
+                CheckSameIds(query, expected, search_server->FindTopDocuments(execution::seq, query, filter));
+                CheckSameIds(query, expected, search_server->FindTopDocuments(execution::par, query, filter));
+            }
+            CheckSameIds(query, search_server->FindTopDocuments(execution::seq, query, AnyDocument{}),
+                         search_server->FindTopDocuments(execution::par, query, filters[8]));
+            for (const DocumentStatus status : {DocumentStatus::ACTUAL, DocumentStatus::IRRELEVANT, DocumentStatus::BANNED, DocumentStatus::REMOVED}) {
+                const auto expected = search_server->FindTopDocuments(execution::seq, query, [status](int, DocumentStatus document_status, int) {
+                    return document_status == status;
+                });
+                CheckSameIds(query, expected, search_server->FindTopDocuments(execution::seq, query, status));
+                CheckSameIds(query, expected, search_server->FindTopDocuments(execution::par, query, status));
+            }
+        }
+    }
+}
+//Сжатие блока обратимо, а хранилище COMPRESSED отдаёт те же тексты после удалений и уплотнения
+void CheckCompressedDocumentStore() {
+    mt19937 generator(7);
+    const auto random_text = [&generator](size_t length, char max_char) {
+        string text(length, 'a');
+        for (char& c : text) {
+            c = uniform_int_distribution<int>('a', max_char)(generator);
+        }
+        return text;
+    };
+    //Длинные литералы и совпадения (коды длины 15 и байты 255), перекрывающиеся совпадения, несжимаемое
+    const vector<string> blocks = {""s, "a"s, "abcabcabcabc"s, string(70'000, 'x'), random_text(1000, 'z'),
+                                   random_text(DocumentStore::BLOCK_SIZE, 'c'), "head "s + random_text(600, 'z') + string(300, 'q') + " tail"s};
+    for (const string& block : blocks) {
+        if (DecompressBlock(CompressBlock(block), block.size()) != block) {
+            throw logic_error("Check failed: compressed block of size "s + to_string(block.size()));
+        }
+    }
+
+    SearchServerOptions options;
+    options.text_storage = TextStorageMode::COMPRESSED;
+    SearchServer search_server(""s, options);
+    map<int, string> texts;
+    for (int id = 0; id < 3000; ++id) {
+        //Слова из небольшого словаря сжимаются; тексты пересекают границы блоков
+        string text;
+        for (int i = uniform_int_distribution(1, 60)(generator); i > 0; --i) {
+            text += "w"s + to_string(uniform_int_distribution(0, 50)(generator)) + " "s;
+        }
+        search_server.AddDocument(id, text, DocumentStatus::ACTUAL, {1});
+        texts[id] = text;
+    }
+    const auto check_texts = [&](string_view mark) {
+        map<int, string> visited;
+        search_server.ForEachDocumentText([&visited](int document_id, string_view text) {
+            visited[document_id] = string(text);
+        });
+        if (visited != texts || search_server.GetDocumentCount() != static_cast<int>(texts.size())) {
+            throw logic_error("Check failed: compressed texts "s + string(mark));
+        }
+        for (const auto& [id, text] : texts) {
+            if (search_server.GetDocumentText(id) != text) {
+                throw logic_error("Check failed: compressed text of document "s + to_string(id) + " "s + string(mark));
+            }
+        }
+    };
+    check_texts("after add"sv);
+    for (int id = 0; id < 3000; id += 3) {
+        search_server.RemoveDocument(id);
+        texts.erase(id);
+    }
+    //Целиком удалённые блоки освобождаются
+    for (int id = 1000; id < 2000; ++id) {
+        search_server.RemoveDocument(id);
+        texts.erase(id);
+    }
+    check_texts("after remove"sv);
+    const size_t stored_bytes = search_server.GetMemoryStats().document_store.bytes;
+    search_server.CompactMemory();
+    check_texts("after compact"sv);
+    if (search_server.GetMemoryStats().document_store.bytes >= stored_bytes) {
+        throw logic_error("Check failed: compacted store is not smaller"s);
+    }
+}
+//Изменение, не дошедшее до диска, не видно в сервере и не появляется после перезапуска.
+//Ошибку записи журнала даёт ограничение размера файла (EFBIG)
+void CheckDurableWriteFailure() {
+    const auto directory = filesystem::temp_directory_path() / ("search_server_check_"s + to_string(random_device()()));
+    filesystem::create_directories(directory);
+    const auto expect_write_error = [](string_view mark, const auto& change) {
+        try {
+            change();
+        } catch (const system_error&) {
+            return;
+        }
+        throw logic_error("Check failed: no write error for "s + string(mark));
+    };
+    {
+        DurableSearchServer durable(""sv, directory.string());
+        durable.AddDocument(1, "cat"sv, DocumentStatus::ACTUAL, {1});
+
+        const auto previous_handler = signal(SIGXFSZ, SIG_IGN);
+        rlimit previous_limit{};
+        getrlimit(RLIMIT_FSIZE, &previous_limit);
+        rlimit limit = previous_limit;
+        limit.rlim_cur = filesystem::file_size(directory / "wal");
+        setrlimit(RLIMIT_FSIZE, &limit);
+        expect_write_error("add"sv, [&] {
+            durable.AddDocument(2, "dog"sv, DocumentStatus::ACTUAL, {1});
+        });
+        setrlimit(RLIMIT_FSIZE, &previous_limit);
+        signal(SIGXFSZ, previous_handler);
+
+        const SearchServer& search_server = durable.GetServer();
+        if (search_server.GetDocumentCount() != 1 || !search_server.FindTopDocuments("dog"sv).empty()) {
+            throw logic_error("Check failed: unlogged document is visible"s);
+        }
+        //Журнал после ошибки записи не принимает изменений, сервер не меняется
+        try {
+            durable.RemoveDocument(1);
+            throw logic_error("Check failed: remove after a write error"s);
+        } catch (const runtime_error&) {
+        }
+        if (search_server.FindTopDocuments("cat"sv).size() != 1) {
+            throw logic_error("Check failed: unlogged remove is applied"s);
+        }
+    }
+    {
+        DurableSearchServer durable(""sv, directory.string());
+        if (durable.GetServer().GetDocumentCount() != 1 || durable.GetServer().FindTopDocuments("cat"sv).size() != 1) {
+            throw logic_error("Check failed: recovery after a write error"s);
+        }
+        durable.AddDocument(2, "dog"sv, DocumentStatus::ACTUAL, {1});
+        try {
+            durable.AddDocument(2, "bird"sv, DocumentStatus::ACTUAL, {1});
+            throw logic_error("Check failed: duplicate durable add"s);
+        } catch (const invalid_argument&) {
+        }
+    }
+    if (DurableSearchServer(""sv, directory.string()).GetServer().GetDocumentCount() != 2) {
+        throw logic_error("Check failed: retried document is lost"s);
+    }
+    filesystem::remove_all(directory);
+}
+//Параллельное добавление с публикацией даёт тот же индекс, что и обычное, а id ждущего документа занят
+void CheckParallelIngestion() {
+    SearchServer sequential(""s), parallel(""s);
+    vector<string> texts;
+    for (int id = 0; id < 500; ++id) {
+        texts.push_back("w"s + to_string(id % 11) + " w"s + to_string(id % 7) + " w"s + to_string(id % 5));
+        sequential.AddDocument(id, texts[id], DocumentStatus::ACTUAL, {id % 9});
+    }
+    vector<int> ids(texts.size());
+    iota(ids.begin(), ids.end(), 0);
+    for_each(execution::par, ids.begin(), ids.end(), [&parallel, &texts](int id) {
+        parallel.AddDocument(execution::par, id, texts[id], DocumentStatus::ACTUAL, {id % 9});
+    });
+    if (parallel.GetDocumentCount() != 0 || parallel.PublishDocuments() != texts.size()) {
+        throw logic_error("Check failed: PublishDocuments"s);
+    }
+    for (const string_view query : {"w1"sv, "w3 w4 -w2"sv, "w10 w6 w0"sv}) {
+        const auto expected = sequential.FindTopDocuments<100>(execution::seq, query, AnyDocument{});
+        const auto actual = parallel.FindTopDocuments<100>(execution::seq, query, AnyDocument{});
+        CheckSameIds(query, expected, actual);
+    }
+
+    SearchServer search_server(""s);
+    search_server.AddDocument(execution::par, 5, "alpha beta"sv, DocumentStatus::ACTUAL, {1});
+    try {
+        search_server.AddDocument(5, "gamma"sv, DocumentStatus::ACTUAL, {1});
+        throw logic_error("Check failed: sequential add of a pending id"s);
+    } catch (const invalid_argument&) {
+    }
+    search_server.PublishDocuments();
+    if (search_server.FindTopDocuments("alpha"sv).size() != 1 || !search_server.FindTopDocuments("gamma"sv).empty()
+        || search_server.GetDocumentText(5) != "alpha beta"s) {
+        throw logic_error("Check failed: published document 5"s);
+    }
+    search_server.RemoveDocument(5);
+    if (search_server.GetDocumentCount() != 0 || !search_server.FindTopDocuments("alpha"sv, DocumentStatus::ACTUAL).empty()) {
+        throw logic_error("Check failed: removed document 5"s);
+    }
+
+    //Добавление, прерванное нехваткой памяти на любом шаге, не занимает id и не оставляет документа
+    SearchServerOptions options;
+    options.positional_index = true;
+    SearchServer failing(""s, options);
+    failing.AddDocument(execution::par, 8, "text in the buffer"sv, DocumentStatus::ACTUAL, {2});
+    for (int failure = 0;; ++failure) {
+        allocations_until_failure = failure;
+        try {
+            failing.AddDocument(execution::par, 9, "long enough text to leave the short string buffer"sv, DocumentStatus::ACTUAL, {1});
+            allocations_until_failure = -1;
+            break;
+        } catch (const bad_alloc&) {
+            allocations_until_failure = -1;
+        }
+        if (failing.HasDocument(9)) {
+            throw logic_error("Check failed: id claimed by a failed add after "s + to_string(failure) + " allocations"s);
+        }
+    }
+    if (failing.PublishDocuments() != 2 || failing.FindTopDocuments("buffer"sv).size() != 2 || failing.FindTopDocuments("long"sv).size() != 1
+        || failing.GetDocumentCount() != 2 || get<0>(failing.MatchDocument("\"string buffer\""sv, 9)).size() != 2) {
+        throw logic_error("Check failed: published document after failed adds"s);
+    }
+}
+//Пакетная проверка документов находит те же слова, что и MatchDocument, в том числе слова фраз
+void CheckPhraseMatch() {
+    SearchServerOptions options;
+    options.positional_index = true;
+    SearchServer search_server("the"s, options);
+    const vector<string> texts = {"the cat dog"s, "tea zzz"s, "dog cat the"s, "white cat dog tea"s};
+    for (size_t id = 0; id < texts.size(); ++id) {
+        search_server.AddDocument(id, texts[id], DocumentStatus::ACTUAL, {1});
+    }
+    const vector<int> ids = {0, 1, 2, 3};
+    for (const string_view query : {"tea \"the cat dog\""sv, "\"cat dog\" zzz"sv, "aaa \"white cat\" -zzz"sv}) {
+        const auto matched = search_server.MatchDocuments(query, ids);
+        for (const auto& match : matched.documents) {
+            vector<string_view> expected = get<0>(search_server.MatchDocument(query, match.document_id));
+            vector<string_view> actual(matched.words.begin() + match.words_begin, matched.words.begin() + match.words_begin + match.words_count);
+            sort(expected.begin(), expected.end());
+            sort(actual.begin(), actual.end());
+            if (expected != actual) {
+                throw logic_error("Check failed: "s + string(query) + " in document "s + to_string(match.document_id));
+            }
+        }
+    }
+    //Непарная кавычка — ошибка запроса с любой стороны слова
+    for (const string_view query : {"cat\""sv, "\"cat"sv, "dog ca\"t"sv, "\"cat \"dog\""sv, "-\"cat"sv}) {
+        try {
+            search_server.FindTopDocuments(query);
+            throw logic_error("Check failed: unpaired quote accepted in "s + string(query));
+        } catch (const invalid_argument&) {
+        }
+    }
+    if (search_server.FindTopDocuments("\"cat\""sv).size() != 3) {
+        throw logic_error("Check failed: one-word phrase"s);
+    }
+
+    //Без позиций кавычки — часть слова, как до появления фраз
+    SearchServer plain(""s);
+    plain.AddDocument(1, "\"new york\" city"s, DocumentStatus::ACTUAL, {1});
+    plain.AddDocument(2, "new york"s, DocumentStatus::ACTUAL, {1});
+    const auto found = plain.FindTopDocuments("\"new york\""sv);
+    if (found.size() != 1 || found[0].id != 1 || get<0>(plain.MatchDocument("cat\" \"new"sv, 1)) != vector<string_view>{"\"new"sv}) {
+        throw logic_error("Check failed: quotes without positional index"s);
+    }
+}
+//Шарды возвращают те же документы в том же порядке, что и один сервер, в том числе при равной релевантности
+void CheckShardedTies() {
+    SearchServer single(""s);
+    ShardedSearchServer sharded(""s, 4);
+    for (int id = 0; id < 40; ++id) {
+        const string text = "cat w"s + to_string(id % 3);
+        single.AddDocument(id, text, DocumentStatus::ACTUAL, {id % 2});
+        sharded.AddDocument(id, text, DocumentStatus::ACTUAL, {id % 2});
+    }
+    for (const string_view query : {"cat"sv, "cat w1"sv, "w2 -w0"sv}) {
+        const auto expected = single.FindTopDocuments(query);
+        const auto actual = sharded.FindTopDocuments(query);
+        CheckSameIds(query, expected, actual);
+    }
+    //Префикс сверх MAX_PREFIX_EXPANSIONS слов раскрывается в шардах в те же слова, что у одного сервера:
+    //q0..q999 и каждое седьмое слово после q1000 встречаются дважды, из остальных остаются меньшие,
+    //а рейтинг выше у редких: первым идёт q1093, самое старшее из оставленных
+    SearchServer single_prefix(""s);
+    ShardedSearchServer sharded_prefix(""s, 4);
+    for (int word = 0; word < 1100; ++word) {
+        for (int copy = 0; copy < (word < 1000 ? 2 : 1); ++copy) {
+            const int id = word * 2 + copy;
+            const string text = "q"s + to_string(word) + (word % 7 == 0 ? " q"s + to_string(word + 1) + " other"s : ""s);
+            single_prefix.AddDocument(id, text, DocumentStatus::ACTUAL, {word});
+            sharded_prefix.AddDocument(id, text, DocumentStatus::ACTUAL, {word});
+        }
+    }
+    for (const string_view query : {"q*"sv, "q10* other"sv, "q* -q1023"sv, "other q*"sv}) {
+        const auto expected = single_prefix.FindTopDocuments(query);
+        const auto actual = sharded_prefix.FindTopDocuments(query);
+        CheckSameIds(query, expected, actual);
+        if (!equal(expected.begin(), expected.end(), actual.begin(), [](const Document& lhs, const Document& rhs) {
+                return lhs.relevance == rhs.relevance;
+            })) {
+            throw logic_error("Check failed: sharded relevance over the prefix cap for "s + string(query));
+        }
+    }
+    if (single_prefix.FindTopDocuments("q*"sv).front().id != 2 * 1093) {
+        throw logic_error("Check failed: kept prefix words"s);
+    }
+
+    //Исключение предиката в шарде доходит до вызывающего, а не завершает программу
+    try {
+        sharded.FindTopDocuments("cat"sv, [](int document_id, DocumentStatus, int) {
+            if (document_id == 17) {
+                throw out_of_range("predicate"s);
+            }
+            return true;
+        });
+        throw logic_error("Check failed: sharded predicate exception"s);
+    } catch (const out_of_range&) {
+    }
+}
+//Отменённый запрос прерывается на любом пути поиска
+void CheckCancellation() {
+    SearchServer search_server(""s);
+    for (int id = 0; id < 100; ++id) {
+        search_server.AddDocument(id, "cat dog w"s + to_string(id % 4), id % 10 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL, {1});
+    }
+    CancellationToken token;
+    token.Cancel();
+    const auto query = search_server.ParseQuery("cat w1 -w2"sv);
+    const auto expect_cancelled = [](string_view mark, const auto& search) {
+        try {
+            search();
+        } catch (const QueryCancelled&) {
+            return;
+        }
+        throw logic_error("Check failed: cancelled "s + string(mark));
+    };
+    expect_cancelled("seq"sv, [&] {
+        return search_server.FindTopDocuments<5>(execution::seq, query, AnyDocument{}, &token);
+    });
+    expect_cancelled("par"sv, [&] {
+        return search_server.FindTopDocuments<5>(execution::par, query, AnyDocument{}, &token);
+    });
+    expect_cancelled("status"sv, [&] {
+        return search_server.FindTopDocuments<5>(execution::seq, query, DocumentStatus::BANNED, &token);
+    });
+}
+//Копия сервера ищет так же, как оригинал, и не зависит от него после его удаления
+void CheckCopy() {
+    SearchServerOptions options;
+    options.impact_ordered_postings = true;
+    options.positional_index = true;
+    options.vectorized_scoring = true;
+    const auto fill = [](SearchServer& search_server) {
+        for (int id = 0; id < 200; ++id) {
+            search_server.AddDocument(id, "white cat w"s + to_string(id % 6) + " x"s + to_string(id % 5), DocumentStatus::ACTUAL, {id % 4});
+        }
+        search_server.RemoveDocument(7);
+    };
+    SearchServer expected("x0"s, options);
+    fill(expected);
+    auto original = make_unique<SearchServer>("x0"s, options);
+    fill(*original);
+    const SearchServer copy(*original);
+    original.reset();
+    for (const string_view query : {"cat"sv, "w1 x1 -w2"sv, "\"white cat\" w3"sv, "w* -x3"sv}) {
+        CheckSameIds(query, expected.FindTopDocuments<20>(execution::seq, query, AnyDocument{}),
+                     copy.FindTopDocuments<20>(execution::seq, query, AnyDocument{}));
+        if (get<0>(expected.MatchDocument(query, 3)) != get<0>(copy.MatchDocument(query, 3))) {
+            throw logic_error("Check failed: copied match of "s + string(query));
+        }
+    }
+    if (copy.GetDocumentCount() != expected.GetDocumentCount() || copy.GetDocumentText(3) != expected.GetDocumentText(3)) {
+        throw logic_error("Check failed: copied documents"s);
+    }
+}
+//Векторное ядро складывает так же, как обычный цикл, и поиск с ним находит те же документы
+void CheckScoringKernel() {
+    mt19937 generator(42);
+    vector<int32_t> all_ids(5000);
+    iota(all_ids.begin(), all_ids.end(), 0);
+    vector<float> expected(all_ids.size(), 0.0f), actual(all_ids.size(), 0.0f);
+    //Длины не кратны ширине векторов, чтобы проверить и хвосты. Упорядоченные id с редкими пропусками
+    //идут отрезками подряд, как в списках частых слов
+    for (const size_t count : {size_t{0}, size_t{5}, size_t{8}, size_t{16}, size_t{1013}, size_t{4999}, size_t{4900}}) {
+        shuffle(all_ids.begin(), all_ids.end(), generator);
+        vector<int32_t> ids(all_ids.begin(), all_ids.begin() + count);
+        if (count == 4900) {
+            sort(ids.begin(), ids.end());
+        }
+        vector<float> term_freqs(count);
+        for (float& term_freq : term_freqs) {
+            term_freq = uniform_real_distribution<float>(0.0f, 1.0f)(generator);
+        }
+        const float inverse_document_freq = uniform_real_distribution<float>(0.1f, 5.0f)(generator);
+        for (size_t i = 0; i < count; ++i) {
+            expected[ids[i]] += term_freqs[i] * inverse_document_freq;
+        }
+        AccumulateScores(ids.data(), term_freqs.data(), count, inverse_document_freq, actual.data());
+    }
+    for (size_t id = 0; id < expected.size(); ++id) {
+        if (abs(expected[id] - actual[id]) > 1e-5f * max(1.0f, abs(expected[id]))) {
+            throw logic_error("Check failed: "s + GetScoringKernelName() + " kernel at document "s + to_string(id));
+        }
+    }
+
+    SearchServerOptions options;
+    options.vectorized_scoring = true;
+    SearchServer plain(""s), vectorized(""s, options);
+    for (int id = 0; id < 3000; ++id) {
+        const string text = "w"s + to_string(id % 13) + " w"s + to_string(id % 7) + " w"s + to_string(id % 29) + " w"s + to_string(id % 3);
+        plain.AddDocument(id, text, DocumentStatus::ACTUAL, {id % 10});
+        vectorized.AddDocument(id, text, DocumentStatus::ACTUAL, {id % 10});
+    }
+    for (const string_view query : {"w1"sv, "w2 w5 w11"sv, "w0 w3 -w6"sv, "w1* -w12"sv}) {
+        CheckSameIds(query, plain.FindTopDocuments<50>(execution::seq, query, AnyDocument{}),
+                     vectorized.FindTopDocuments<50>(execution::seq, query, AnyDocument{}));
+        CheckSameIds(query, plain.FindTopDocuments(query), vectorized.FindTopDocuments(query));
+    }
+}
+//Параллельные Add и operator[] дают то же, что и обычная мапа, чтение без блокировки видит записи
+void CheckConcurrentMap() {
+    const int key_count = 1000;
+    const int operation_count = 200'000;
+    vector<int> operations(operation_count);
+    iota(operations.begin(), operations.end(), 0);
+
+    ConcurrentMap<int, long long> sums(16);
+    atomic<int> missing{0};
+    for_each(execution::par, operations.begin(), operations.end(), [&sums, &missing](int i) {
+        sums.Add(i % key_count, i);
+        //Ключ уже добавлен этим же потоком, поэтому Find обязан его найти
+        if (!sums.Find(i % key_count)) {
+            ++missing;
+        }
+    });
+    map<int, long long> expected_sums;
+    for (const int i : operations) {
+        expected_sums[i % key_count] += i;
+    }
+    if (missing != 0 || sums.size() != static_cast<size_t>(key_count) || sums.BuildOrdinaryMap() != expected_sums) {
+        throw logic_error("Check failed: ConcurrentMap::Add"s);
+    }
+    for (int key = 0; key < key_count; key += 2) {
+        sums.erase(key);
+    }
+    if (sums.size() != static_cast<size_t>(key_count / 2) || sums.Find(0) || sums.Find(1) != expected_sums[1]) {
+        throw logic_error("Check failed: ConcurrentMap::erase"s);
+    }
+
+    //Вставки и удаления при пустой карте перестраивают массивы того же размера; старые массивы
+    //освобождаются, даже если параллельно читают
+    ConcurrentMap<int, int> churn(16);
+    const size_t churn_bytes = [&churn] {
+        churn.Add(0, 1);
+        churn.erase(0);
+        return churn.GetTableBytes();
+    }();
+    for (int round = 0; round < 4; ++round) {
+        for_each(execution::par, operations.begin(), operations.end(), [&churn, round](int i) {
+            if (i % 4 == 0) {
+                churn.Find(i);
+                return;
+            }
+            churn.Add(round * operation_count + i, 1);
+            churn.erase(round * operation_count + i);
+        });
+    }
+    for (int i = 0; i < 100'000; ++i) {
+        churn.Add(i, 1);
+        churn.erase(i);
+    }
+    if (churn.size() != 0 || churn.GetTableBytes() > churn_bytes * 4 * 16) {
+        throw logic_error("Check failed: ConcurrentMap keeps replaced tables: "s + to_string(churn.GetTableBytes()) + " bytes"s);
+    }
+
+    ConcurrentMap<int, string> texts(16);
+    for_each(execution::par, operations.begin(), operations.begin() + 10'000, [&texts](int i) {
+        texts[i % 100].ref_to_value.push_back('x');
+    });
+    const auto built = texts.BuildOrdinaryMap();
+    if (built.size() != 100 || any_of(built.begin(), built.end(), [](const auto& entry) {
+            return entry.second.size() != 100;
+        })) {
+        throw logic_error("Check failed: ConcurrentMap::operator[]"s);
+    }
+}
+//Запросы через планировщик дают тот же результат, что и прямой поиск, а отменённые и просроченные
+//завершаются QueryCancelled
+void CheckRequestScheduler() {
+    SearchServer search_server("and"s);
+    for (int id = 0; id < 2000; ++id) {
+        search_server.AddDocument(id, "cat and w"s + to_string(id % 17) + " x"s + to_string(id % 5),
+                                  id % 4 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL, {id % 6});
+    }
+    const vector<string_view> queries = {"cat"sv, "w3 x1"sv, "w5 -x2"sv, "x*"sv};
+    const auto expect_cancelled = [](string_view mark, auto& future) {
+        try {
+            future.get();
+        } catch (const QueryCancelled&) {
+            return;
+        }
+        throw logic_error("Check failed: scheduled "s + string(mark));
+    };
+
+    RequestScheduler scheduler(search_server, 4);
+    for (const string_view query : queries) {
+        for (const DocumentStatus status : {DocumentStatus::ACTUAL, DocumentStatus::BANNED}) {
+            CheckSameIds(query, search_server.FindTopDocuments(query, status), scheduler.FindTopDocumentsAsync(query, status).get());
+        }
+        if (get<0>(scheduler.MatchDocumentAsync(query, 3).get()) != get<0>(search_server.MatchDocument(query, 3))) {
+            throw logic_error("Check failed: scheduled match of "s + string(query));
+        }
+
+        auto cancelled = make_shared<CancellationToken>();
+        cancelled->Cancel();
+        auto cancelled_search = scheduler.FindTopDocumentsAsync(query, DocumentStatus::ACTUAL, cancelled);
+        expect_cancelled(query, cancelled_search);
+        const auto expired = make_shared<CancellationToken>(CancellationToken::Clock::now() - chrono::milliseconds(1));
+        auto expired_search = scheduler.FindTopDocumentsAsync(query, DocumentStatus::BANNED, expired);
+        expect_cancelled(query, expired_search);
+        auto expired_match = scheduler.MatchDocumentAsync(query, 3, expired);
+        expect_cancelled(query, expired_match);
+    }
+}
 int main() {
+    CheckRequestScheduler();
+    CheckConcurrentMap();
+    CheckScoringKernel();
+    CheckCopy();
+    CheckCancellation();
+    CheckShardedTies();
+    CheckPhraseMatch();
+    CheckParallelIngestion();
+    CheckImpactOrderedPostings();
+    CheckPackedRelevanceOrder();
+    CheckStopWords();
+    CheckQueryPlans();
+    CheckBatchRemove();
+    CheckDocumentFilter();
+    CheckCompressedDocumentStore();
+    CheckMemoryBudget();
+    CheckReadDocuments();
+    CheckDurableRecovery();
+    CheckDurableWriteFailure();
+    CheckMinusPrefix();
+    CheckPrefixCap();
     mt19937 generator;
     const auto dictionary = GenerateDictionary(generator, 1000, 10);
     const auto documents = GenerateQueries(generator, dictionary, 10'000, 70);
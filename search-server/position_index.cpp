@@ -0,0 +1,99 @@
+#include "position_index.h"
+#include <stdexcept>
+
+namespace {
+
+void AppendVarint(std::string& output, uint32_t value) {
+    while (value >= 0x80) {
+        output.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    output.push_back(static_cast<char>(value));
+}
+
+uint32_t ReadVarint(std::string_view& input) {
+    uint32_t value = 0;
+    for (int shift = 0; !input.empty() && shift < 35; shift += 7) {
+        const auto byte = static_cast<unsigned char>(input.front());
+        input.remove_prefix(1);
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+    throw std::logic_error("Corrupted position stream");
+}
+
+}  // namespace
+
+PositionIndex::Reader::Reader(std::string_view stream) : stream_(stream) {}
+
+void PositionIndex::Reader::Read(std::vector<uint32_t>& positions) {
+    const uint32_t length = ReadVarint(stream_);
+    std::string_view record = stream_.substr(0, length);
+    stream_.remove_prefix(length);
+
+    positions.resize(ReadVarint(record));
+    uint32_t position = 0;
+    for (uint32_t& value : positions) {
+        position += ReadVarint(record);
+        value = position;
+    }
+}
+
+void PositionIndex::Reader::Skip() {
+    const uint32_t length = ReadVarint(stream_);
+    stream_.remove_prefix(length);
+}
+
+void PositionIndex::AppendWordPositions(std::string& stream, const std::vector<uint32_t>& positions) {
+    std::string record;
+    AppendVarint(record, static_cast<uint32_t>(positions.size()));
+    uint32_t previous = 0;
+    for (const uint32_t position : positions) {
+        AppendVarint(record, position - previous);
+        previous = position;
+    }
+    AppendVarint(stream, static_cast<uint32_t>(record.size()));
+    stream += record;
+}
+
+void PositionIndex::Add(int document_id, const std::string_view stream) {
+    documents_[document_id] = {data_.size(), stream.size()};
+    data_.append(stream);
+}
+
+void PositionIndex::Remove(int document_id) {
+    const auto it = documents_.find(document_id);
+    if (it != documents_.end()) {
+        removed_bytes_ += it->second.length;
+        documents_.erase(it);
+    }
+}
+
+PositionIndex::Reader PositionIndex::GetReader(int document_id) const {
+    const auto it = documents_.find(document_id);
+    if (it == documents_.end()) {
+        return Reader();
+    }
+    return Reader(std::string_view(data_).substr(it->second.offset, it->second.length));
+}
+
+size_t PositionIndex::GetByteCount() const {
+    return data_.capacity() + documents_.size() * (sizeof(int) + sizeof(Span) + sizeof(void*));
+}
+
+void PositionIndex::Compact() {
+    if (removed_bytes_ == 0) {
+        return;
+    }
+    std::string data;
+    data.reserve(data_.size() - removed_bytes_);
+    for (auto& [_, span] : documents_) {
+        const size_t offset = data.size();
+        data.append(data_, span.offset, span.length);
+        span.offset = offset;
+    }
+    data_ = std::move(data);
+    removed_bytes_ = 0;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+//Позиции слов в документах для поиска фраз. Поток документа — записи по его словам
+//в порядке прямого индекса (по возрастанию слова): длина записи в байтах, число позиций
+//и позиции разностями от предыдущей, всё в varint. Потоки всех документов лежат подряд в одном буфере
+class PositionIndex {
+public:
+    //Последовательное чтение потока одного документа
+    class Reader {
+    public:
+        explicit Reader(std::string_view stream = {});
+
+        //Позиции текущего слова, переход к следующему
+        void Read(std::vector<uint32_t>& positions);
+        //Переход к следующему слову без разбора позиций
+        void Skip();
+
+    private:
+        std::string_view stream_;
+    };
+
+    //Дописывает запись очередного слова в поток документа
+    static void AppendWordPositions(std::string& stream, const std::vector<uint32_t>& positions);
+
+    void Add(int document_id, const std::string_view stream);
+    void Remove(int document_id);
+    Reader GetReader(int document_id) const;
+
+    size_t GetByteCount() const;
+    //Убирает из буфера потоки удалённых документов
+    void Compact();
+
+private:
+    struct Span {
+        size_t offset;
+        size_t length;
+    };
+
+    std::string data_;
+    std::unordered_map<int, Span> documents_;
+    size_t removed_bytes_ = 0;
+};
@@ -1,5 +1,13 @@
 #include "read_input_functions.h"
+#include <charconv>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
 
 std::string ReadLine() {
     std::string s;
@@ -13,3 +21,264 @@ int ReadLineWithNumber() {
     ReadLine();
     return result;
 }
+
+namespace {
+
+//Размер одного чтения из потока
+const size_t READ_BLOCK_SIZE = 1 << 20;
+//Сколько разобранных блоков может ждать индексации
+const size_t MAX_PENDING_BLOCKS = 4;
+
+//Блок входных данных и разобранные из него записи.
+//Тексты записей ссылаются прямо в data, рейтинги лежат подряд в ratings
+struct ParsedBlock {
+    struct Record {
+        int id;
+        DocumentStatus status;
+        size_t ratings_begin;
+        size_t rating_count;
+        std::string_view text;
+    };
+
+    std::string data;
+    std::vector<Record> records;
+    std::vector<int> ratings;
+};
+
+class BlockQueue {
+public:
+    //false, если потребитель уже остановил очередь
+    bool Push(std::unique_ptr<ParsedBlock> block) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return closed_ || blocks_.size() < MAX_PENDING_BLOCKS; });
+        if (closed_) {
+            return false;
+        }
+        blocks_.push_back(std::move(block));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    //nullptr, когда данные закончились
+    std::unique_ptr<ParsedBlock> Pop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return finished_ || !blocks_.empty(); });
+        if (blocks_.empty()) {
+            return nullptr;
+        }
+        auto block = std::move(blocks_.front());
+        blocks_.pop_front();
+        not_full_.notify_one();
+        return block;
+    }
+
+    void Finish(std::exception_ptr error = nullptr) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        finished_ = true;
+        error_ = error;
+        not_empty_.notify_all();
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_full_.notify_all();
+    }
+
+    std::exception_ptr GetError() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return error_;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+    std::deque<std::unique_ptr<ParsedBlock>> blocks_;
+    bool finished_ = false;
+    bool closed_ = false;
+    std::exception_ptr error_;
+};
+
+std::string_view NextField(std::string_view& line) {
+    const auto begin = line.find_first_not_of(' ');
+    if (begin == std::string_view::npos) {
+        line = {};
+        return {};
+    }
+    line.remove_prefix(begin);
+    const auto end = std::min(line.find(' '), line.size());
+    const auto field = line.substr(0, end);
+    line.remove_prefix(end);
+    return field;
+}
+
+int ParseNumber(std::string_view& line, size_t line_number) {
+    const auto field = NextField(line);
+    int value = 0;
+    const auto [ptr, error] = std::from_chars(field.data(), field.data() + field.size(), value);
+    if (field.empty() || error != std::errc() || ptr != field.data() + field.size()) {
+        throw std::invalid_argument("Invalid number in document record at line " + std::to_string(line_number));
+    }
+    return value;
+}
+
+//Рейтинги дописываются в конец ratings, текст ссылается в line
+void ParseRecordFields(std::string_view line, size_t line_number, int& id, DocumentStatus& status,
+                       std::vector<int>& ratings, std::string_view& text) {
+    id = ParseNumber(line, line_number);
+    const int status_number = ParseNumber(line, line_number);
+    if (status_number < static_cast<int>(DocumentStatus::ACTUAL) || status_number > static_cast<int>(DocumentStatus::REMOVED)) {
+        throw std::invalid_argument("Invalid document status at line " + std::to_string(line_number));
+    }
+    status = static_cast<DocumentStatus>(status_number);
+
+    const int rating_count = ParseNumber(line, line_number);
+    if (rating_count < 0) {
+        throw std::invalid_argument("Invalid rating count at line " + std::to_string(line_number));
+    }
+    for (int i = 0; i < rating_count; ++i) {
+        ratings.push_back(ParseNumber(line, line_number));
+    }
+
+    //Текст отделён от чисел ровно одним пробелом и берётся как есть, с пробелами по краям
+    if (!line.empty()) {
+        line.remove_prefix(1);
+    }
+    text = line;
+}
+
+void ParseRecord(std::string_view line, size_t line_number, ParsedBlock& block) {
+    ParsedBlock::Record record;
+    record.ratings_begin = block.ratings.size();
+    ParseRecordFields(line, line_number, record.id, record.status, block.ratings, record.text);
+    record.rating_count = block.ratings.size() - record.ratings_begin;
+    block.records.push_back(record);
+}
+
+void AppendNumber(std::string& output, int value) {
+    char buffer[16];
+    const auto [end, _] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    output.append(buffer, end);
+}
+
+//Читает поток блоками, отрезает неполную последнюю строку и переносит её в следующий блок
+void ProduceBlocks(std::istream& input, BlockQueue& queue) {
+    std::string pending;
+    size_t line_number = 0;
+
+    while (true) {
+        auto block = std::make_unique<ParsedBlock>();
+        block->data = std::move(pending);
+        pending.clear();
+
+        const size_t old_size = block->data.size();
+        block->data.resize(old_size + READ_BLOCK_SIZE);
+        input.read(block->data.data() + old_size, READ_BLOCK_SIZE);
+        block->data.resize(old_size + input.gcount());
+        const bool at_end = !input;
+
+        size_t end = block->data.size();
+        if (!at_end) {
+            const auto last_line_end = block->data.rfind('\n');
+            if (last_line_end == std::string::npos) {
+                //Строка длиннее блока, дочитываем
+                pending = std::move(block->data);
+                continue;
+            }
+            end = last_line_end + 1;
+            pending.assign(block->data, end, std::string::npos);
+            block->data.resize(end);
+        }
+
+        std::string_view data = block->data;
+        try {
+            while (!data.empty()) {
+                const auto line_end = std::min(data.find('\n'), data.size());
+                std::string_view line = data.substr(0, line_end);
+                data.remove_prefix(std::min(line_end + 1, data.size()));
+                ++line_number;
+
+                if (!line.empty() && line.back() == '\r') {
+                    line.remove_suffix(1);
+                }
+                if (line.find_first_not_of(' ') != std::string_view::npos) {
+                    ParseRecord(line, line_number, *block);
+                }
+            }
+        } catch (const std::invalid_argument&) {
+            //Записи до ошибочной строки отдаются обработчику, как если бы блок кончался на ней
+            queue.Push(std::move(block));
+            throw;
+        }
+
+        if (!queue.Push(std::move(block)) || at_end) {
+            return;
+        }
+    }
+}
+
+}  // namespace
+
+void ReadDocuments(std::istream& input, const std::function<void(const DocumentRecord&)>& handler) {
+    BlockQueue queue;
+    std::thread producer([&input, &queue] {
+        try {
+            ProduceBlocks(input, queue);
+            queue.Finish();
+        } catch (...) {
+            queue.Finish(std::current_exception());
+        }
+    });
+
+    DocumentRecord record;
+    try {
+        while (auto block = queue.Pop()) {
+            for (const auto& parsed : block->records) {
+                record.id = parsed.id;
+                record.status = parsed.status;
+                record.ratings.assign(block->ratings.begin() + parsed.ratings_begin,
+                                      block->ratings.begin() + parsed.ratings_begin + parsed.rating_count);
+                record.text = parsed.text;
+                handler(record);
+            }
+        }
+    } catch (...) {
+        queue.Close();
+        producer.join();
+        throw;
+    }
+
+    producer.join();
+    if (const auto error = queue.GetError()) {
+        std::rethrow_exception(error);
+    }
+}
+
+size_t LoadDocuments(std::istream& input, SearchServer& search_server) {
+    size_t count = 0;
+    ReadDocuments(input, [&search_server, &count](const DocumentRecord& record) {
+        search_server.AddDocument(record.id, record.text, record.status, record.ratings);
+        ++count;
+    });
+    return count;
+}
+
+void ParseDocumentRecord(const std::string_view line, size_t line_number, DocumentRecord& record) {
+    record.ratings.clear();
+    ParseRecordFields(line, line_number, record.id, record.status, record.ratings, record.text);
+}
+
+void AppendDocumentRecord(std::string& output, int document_id, DocumentStatus status, const std::vector<int>& ratings, const std::string_view text) {
+    AppendNumber(output, document_id);
+    output.push_back(' ');
+    AppendNumber(output, static_cast<int>(status));
+    output.push_back(' ');
+    AppendNumber(output, static_cast<int>(ratings.size()));
+    for (const int rating : ratings) {
+        output.push_back(' ');
+        AppendNumber(output, rating);
+    }
+    output.push_back(' ');
+    output.append(text);
+}
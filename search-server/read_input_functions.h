@@ -1,6 +1,35 @@
 #pragma once
+#include <functional>
+#include <istream>
 #include <string>
+#include <string_view>
+#include <vector>
+#include "search_server.h"
 
 std::string ReadLine();
 int ReadLineWithNumber();
 
+//Запись документа в потоке: "<id> <status> <rating_count> <ratings...> <text>", одна на строку.
+//status — число от 0 (ACTUAL) до 3 (REMOVED). text — остаток строки после одного пробела за последним
+//числом, без обрезки, так что записанный текст читается побайтно тем же. text указывает во внутренний буфер
+//и действителен только во время вызова обработчика.
+struct DocumentRecord {
+    int id = 0;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    std::vector<int> ratings;
+    std::string_view text;
+};
+
+//Чтение и разбор идут в отдельном потоке большими блоками, обработчик вызывается в текущем.
+//Ошибка формата бросает std::invalid_argument с номером строки, все записи до этой строки уже переданы обработчику
+void ReadDocuments(std::istream& input, const std::function<void(const DocumentRecord&)>& handler);
+
+//Разбор одной записи без '\n'. text ссылается в line
+void ParseDocumentRecord(const std::string_view line, size_t line_number, DocumentRecord& record);
+//Запись в том же формате без '\n' дописывается в output
+void AppendDocumentRecord(std::string& output, int document_id, DocumentStatus status, const std::vector<int>& ratings, const std::string_view text);
+
+//Загрузка всех документов потока в сервер, возвращает число добавленных.
+//Параллельно с индексацией идут только чтение и разбор записей, разбиение текста на слова — в текущем потоке.
+//При ошибке формата документы до ошибочной строки остаются добавленными
+size_t LoadDocuments(std::istream& input, SearchServer& search_server);
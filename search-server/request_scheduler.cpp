@@ -0,0 +1,138 @@
+#include "request_scheduler.h"
+#include <algorithm>
+
+RequestScheduler::RequestScheduler(const SearchServer& search_server, size_t thread_count)
+  : search_server_(search_server)
+  , thread_count_(std::max<size_t>(thread_count, 1)) {
+  workers_.reserve(thread_count_);
+  for (size_t i = 0; i < thread_count_; ++i) {
+      workers_.emplace_back([this] { WorkerLoop(); });
+  }
+}
+
+//Потоки дорабатывают всю очередь и только потом завершаются
+RequestScheduler::~RequestScheduler() {
+  {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+  }
+  has_requests_.notify_all();
+  for (auto& worker : workers_) {
+      worker.join();
+  }
+}
+
+std::future<std::vector<Document>> RequestScheduler::FindTopDocumentsAsync(const std::string_view raw_query, DocumentStatus status,
+                                                                           std::shared_ptr<CancellationToken> token) {
+  auto promise = std::make_shared<std::promise<std::vector<Document>>>();
+  auto result = promise->get_future();
+
+  //Разбираем сразу: ошибка запроса попадает в future, а длина списков документов даёт оценку стоимости
+  auto query = std::make_shared<SearchServer::Query>();
+  try {
+      search_server_.ParseQuery(raw_query, *query);
+  } catch (...) {
+      promise->set_exception(std::current_exception());
+      return result;
+  }
+
+  size_t cost = query->plus_words.size() + query->minus_words.size();
+  for (const auto& term : query->plus_words) {
+      if (term.postings != nullptr) {
+          cost += term.postings->size();
+      }
+  }
+
+  Request request;
+  request.cost = cost;
+  request.token = token;
+  request.run = [this, promise, query, status, token] {
+      try {
+          promise->set_value(search_server_.FindTopDocuments(std::execution::seq, *query, status, token.get()));
+      } catch (...) {
+          promise->set_exception(std::current_exception());
+      }
+  };
+  request.cancel = [promise] {
+      promise->set_exception(std::make_exception_ptr(QueryCancelled()));
+  };
+  Push(std::move(request));
+  return result;
+}
+
+std::future<std::tuple<std::vector<std::string_view>, DocumentStatus>> RequestScheduler::MatchDocumentAsync(const std::string_view raw_query, int document_id,
+                                                                                                             std::shared_ptr<CancellationToken> token) {
+  auto promise = std::make_shared<std::promise<std::tuple<std::vector<std::string_view>, DocumentStatus>>>();
+  auto result = promise->get_future();
+
+  auto query = std::make_shared<SearchServer::Query>();
+  try {
+      search_server_.ParseQuery(raw_query, *query);
+  } catch (...) {
+      promise->set_exception(std::current_exception());
+      return result;
+  }
+
+  Request request;
+  //Проверка одного документа дешевле любого поиска
+  request.cost = query->plus_words.size() + query->minus_words.size();
+  request.token = token;
+  request.run = [this, promise, query, document_id, token] {
+      try {
+          promise->set_value(search_server_.MatchDocument(*query, document_id, token.get()));
+      } catch (...) {
+          promise->set_exception(std::current_exception());
+      }
+  };
+  request.cancel = [promise] {
+      promise->set_exception(std::make_exception_ptr(QueryCancelled()));
+  };
+  Push(std::move(request));
+  return result;
+}
+
+void RequestScheduler::Push(Request request) {
+  const std::chrono::nanoseconds estimate = COST_UNIT * static_cast<int64_t>(request.cost);
+  request.due = CancellationToken::Clock::now() + estimate;
+  if (request.token != nullptr && request.token->GetDeadline() != CancellationToken::Clock::time_point::max()) {
+      request.due = std::min(request.due, request.token->GetDeadline() - estimate);
+  }
+  {
+      std::lock_guard<std::mutex> lock(mutex_);
+      request.sequence = next_sequence_++;
+      requests_.push_back(std::move(request));
+      std::push_heap(requests_.begin(), requests_.end(), RequestOrder());
+  }
+  has_requests_.notify_one();
+}
+
+void RequestScheduler::WorkerLoop() {
+  std::vector<Request> batch;
+  batch.reserve(BATCH_SIZE);
+
+  while (true) {
+      {
+          std::unique_lock<std::mutex> lock(mutex_);
+          has_requests_.wait(lock, [this] { return stopping_ || !requests_.empty(); });
+          if (requests_.empty()) {
+              return;
+          }
+          //Делим очередь поровну между потоками, чтобы один поток не забрал всё
+          const size_t take = std::min(BATCH_SIZE, (requests_.size() + thread_count_ - 1) / thread_count_);
+          while (batch.size() < take) {
+              std::pop_heap(requests_.begin(), requests_.end(), RequestOrder());
+              batch.push_back(std::move(requests_.back()));
+              requests_.pop_back();
+          }
+      }
+
+      for (auto& request : batch) {
+          if (request.token != nullptr && request.token->IsCancelled()) {
+              request.cancel();
+          } else {
+              request.run();
+          }
+      }
+      batch.clear();
+  }
+}
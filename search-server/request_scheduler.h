@@ -0,0 +1,72 @@
+#pragma once
+#include "search_server.h"
+#include "cancellation.h"
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Асинхронные запросы к SearchServer на фиксированном наборе потоков.
+//Запрос ждёт в очереди не дольше своей оценки времени выполнения (по суммарной длине списков
+//документов), поэтому дешёвые идут первыми, но не задерживают дорогие бесконечно. Запрос со сроком
+//начинается не позже, чем срок минус оценка времени. Запросы с истёкшим сроком или отменённые
+//завершаются исключением QueryCancelled.
+//Пока есть запросы в очереди, документы в сервере менять нельзя.
+class RequestScheduler {
+public:
+    explicit RequestScheduler(const SearchServer& search_server,
+                              size_t thread_count = std::thread::hardware_concurrency());
+    ~RequestScheduler();
+
+    RequestScheduler(const RequestScheduler&) = delete;
+    RequestScheduler& operator=(const RequestScheduler&) = delete;
+
+    std::future<std::vector<Document>> FindTopDocumentsAsync(const std::string_view raw_query,
+                                                             DocumentStatus status = DocumentStatus::ACTUAL,
+                                                             std::shared_ptr<CancellationToken> token = nullptr);
+
+    std::future<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocumentAsync(const std::string_view raw_query, int document_id,
+                                                                                               std::shared_ptr<CancellationToken> token = nullptr);
+
+private:
+    struct Request {
+        size_t cost;
+        //Когда запрос должен начаться: время постановки плюс оценка времени выполнения или раньше, если есть срок
+        CancellationToken::Clock::time_point due;
+        uint64_t sequence;
+        std::shared_ptr<CancellationToken> token;
+        std::function<void()> run;
+        std::function<void()> cancel;
+    };
+
+    struct RequestOrder {
+        bool operator()(const Request& lhs, const Request& rhs) const {
+            if (lhs.due != rhs.due) {
+                return lhs.due > rhs.due;
+            }
+            return lhs.sequence > rhs.sequence;
+        }
+    };
+
+    //Сколько запросов поток забирает из очереди за один захват мьютекса
+    static constexpr size_t BATCH_SIZE = 8;
+    //Оценка времени обработки одной записи списка документов
+    static constexpr std::chrono::nanoseconds COST_UNIT{100};
+
+    const SearchServer& search_server_;
+    const size_t thread_count_;
+    //Куча по RequestOrder: первым идёт запрос с самым ранним сроком. Обычная куча, а не priority_queue,
+    //чтобы забирать запрос переносом из back() после pop_heap
+    std::vector<Request> requests_;
+    uint64_t next_sequence_ = 0;
+    bool stopping_ = false;
+    std::mutex mutex_;
+    std::condition_variable has_requests_;
+    std::vector<std::thread> workers_;
+
+    void Push(Request request);
+    void WorkerLoop();
+};
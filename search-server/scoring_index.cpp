@@ -0,0 +1,72 @@
+#include "scoring_index.h"
+
+ScoringIndex::List ScoringIndex::BuildList(const DocumentFreqs& postings) {
+    List list;
+    list.document_ids.reserve(postings.size());
+    list.term_freqs.reserve(postings.size());
+    for (const auto [document_id, term_freq] : postings) {
+        list.document_ids.push_back(document_id);
+        list.term_freqs.push_back(static_cast<float>(term_freq));
+    }
+    return list;
+}
+
+void ScoringIndex::MarkDirty(const std::string_view word) {
+    dirty_words_.insert(word);
+    dirty_.store(true, std::memory_order_release);
+}
+
+void ScoringIndex::Erase(const std::string_view word) {
+    dirty_words_.erase(word);
+    EraseList(word);
+}
+
+void ScoringIndex::Refresh(const WordToDocumentFreqs& word_to_document_freqs) {
+    if (!dirty_.load(std::memory_order_acquire)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!dirty_.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    for (const std::string_view word : dirty_words_) {
+        EraseList(word);
+        const auto postings = word_to_document_freqs.find(word);
+        if (postings != word_to_document_freqs.end() && postings->second.size() >= SCORING_MIN_POSTINGS) {
+            List& list = lists_[postings->first] = BuildList(postings->second);
+            bytes_.fetch_add(GetListBytes(list), std::memory_order_relaxed);
+        }
+    }
+    dirty_words_.clear();
+    dirty_.store(false, std::memory_order_release);
+}
+
+const ScoringIndex::List* ScoringIndex::Find(const std::string_view word) const {
+    const auto it = lists_.find(word);
+    return it == lists_.end() ? nullptr : &it->second;
+}
+
+size_t ScoringIndex::GetPostingCount() const {
+    size_t count = 0;
+    for (const auto& [_, list] : lists_) {
+        count += list.document_ids.size();
+    }
+    return count;
+}
+
+size_t ScoringIndex::GetByteCount() const {
+    return bytes_.load(std::memory_order_relaxed);
+}
+
+size_t ScoringIndex::GetListBytes(const List& list) {
+    return list.document_ids.capacity() * sizeof(int32_t) + list.term_freqs.capacity() * sizeof(float);
+}
+
+void ScoringIndex::EraseList(const std::string_view word) {
+    const auto it = lists_.find(word);
+    if (it != lists_.end()) {
+        bytes_.fetch_sub(GetListBytes(it->second), std::memory_order_relaxed);
+        lists_.erase(it);
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string_view>
+#include <vector>
+#include "index_types.h"
+
+//Списки короче этого переводятся в массивы прямо при поиске
+const size_t SCORING_MIN_POSTINGS = 64;
+
+//Копии списков документов двумя массивами (id и частота во float) для векторного подсчёта релевантности
+class ScoringIndex {
+public:
+    struct List {
+        std::vector<int32_t> document_ids;
+        std::vector<float> term_freqs;
+    };
+
+    static List BuildList(const DocumentFreqs& postings);
+
+    void MarkDirty(const std::string_view word);
+    //Слово удаляется из индекса, ссылку на него хранить больше нельзя
+    void Erase(const std::string_view word);
+
+    //Перестраивает списки изменённых слов. Вызывается из поиска, в том числе из нескольких потоков сразу,
+    //но не одновременно с изменением индекса
+    void Refresh(const WordToDocumentFreqs& word_to_document_freqs);
+
+    const List* Find(const std::string_view word) const;
+
+    size_t GetPostingCount() const;
+    size_t GetByteCount() const;
+
+private:
+    std::map<std::string_view, List> lists_;
+    std::set<std::string_view> dirty_words_;
+    std::atomic<bool> dirty_{false};
+    std::atomic<size_t> bytes_{0};
+    std::mutex mutex_;
+
+    static size_t GetListBytes(const List& list);
+    void EraseList(const std::string_view word);
+};
@@ -0,0 +1,98 @@
+#include "scoring_kernel.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define SCORING_KERNEL_X86
+#endif
+
+namespace {
+
+using Kernel = void (*)(const int32_t*, const float*, size_t, float, float*);
+
+void AccumulateScalar(const int32_t* document_ids, const float* term_freqs, size_t count, float inverse_document_freq, float* scores) {
+    for (size_t i = 0; i < count; ++i) {
+        scores[document_ids[i]] += term_freqs[i] * inverse_document_freq;
+    }
+}
+
+#ifdef SCORING_KERNEL_X86
+//Частые слова покрывают подряд идущие id: если 16 id образуют отрезок, буфер читается и пишется
+//обычными загрузкой и записью. Иначе сбор 16 значений, сложение и разброс обратно:
+//id внутри списка разные, разброс безопасен
+__attribute__((target("avx512f")))
+void AccumulateAvx512(const int32_t* document_ids, const float* term_freqs, size_t count, float inverse_document_freq, float* scores) {
+    const __m512 idf = _mm512_set1_ps(inverse_document_freq);
+    const __m512i offsets = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m512i ids = _mm512_loadu_si512(document_ids + i);
+        const __m512 products = _mm512_mul_ps(_mm512_loadu_ps(term_freqs + i), idf);
+        const __m512i run = _mm512_add_epi32(_mm512_set1_epi32(document_ids[i]), offsets);
+        if (_mm512_cmpeq_epi32_mask(ids, run) == 0xFFFF) {
+            float* target = scores + document_ids[i];
+            _mm512_storeu_ps(target, _mm512_add_ps(_mm512_loadu_ps(target), products));
+            continue;
+        }
+        const __m512 sums = _mm512_add_ps(_mm512_mask_i32gather_ps(_mm512_setzero_ps(), 0xFFFF, ids, scores, 4), products);
+        _mm512_i32scatter_ps(scores, ids, sums, 4);
+    }
+    AccumulateScalar(document_ids + i, term_freqs + i, count - i, inverse_document_freq, scores);
+}
+
+//В AVX2 нет разброса: отрезок подряд идущих id — как в AVX-512, иначе сбор и сложение векторные, запись по одному
+__attribute__((target("avx2")))
+void AccumulateAvx2(const int32_t* document_ids, const float* term_freqs, size_t count, float inverse_document_freq, float* scores) {
+    const __m256 idf = _mm256_set1_ps(inverse_document_freq);
+    const __m256i offsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    alignas(32) float sums[8];
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i ids = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(document_ids + i));
+        const __m256 products = _mm256_mul_ps(_mm256_loadu_ps(term_freqs + i), idf);
+        const __m256i run = _mm256_add_epi32(_mm256_set1_epi32(document_ids[i]), offsets);
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(ids, run)) == -1) {
+            float* target = scores + document_ids[i];
+            _mm256_storeu_ps(target, _mm256_add_ps(_mm256_loadu_ps(target), products));
+            continue;
+        }
+        _mm256_store_ps(sums, _mm256_add_ps(_mm256_i32gather_ps(scores, ids, 4), products));
+        for (int lane = 0; lane < 8; ++lane) {
+            scores[document_ids[i + lane]] = sums[lane];
+        }
+    }
+    AccumulateScalar(document_ids + i, term_freqs + i, count - i, inverse_document_freq, scores);
+}
+#endif
+
+struct SelectedKernel {
+    Kernel kernel;
+    const char* name;
+};
+
+SelectedKernel SelectKernel() {
+#ifdef SCORING_KERNEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return {AccumulateAvx512, "avx512"};
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return {AccumulateAvx2, "avx2"};
+    }
+#endif
+    return {AccumulateScalar, "scalar"};
+}
+
+const SelectedKernel& GetKernel() {
+    static const SelectedKernel kernel = SelectKernel();
+    return kernel;
+}
+
+}  // namespace
+
+void AccumulateScores(const int32_t* document_ids, const float* term_freqs, size_t count, float inverse_document_freq, float* scores) {
+    GetKernel().kernel(document_ids, term_freqs, count, inverse_document_freq, scores);
+}
+
+const char* GetScoringKernelName() {
+    return GetKernel().name;
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+//Прибавляет term_freqs[i] * inverse_document_freq к scores[document_ids[i]].
+//id в одном вызове не повторяются, поэтому векторные версии пишут без конфликтов.
+//Версия (AVX-512, AVX2 или обычный цикл) выбирается при первом вызове по возможностям процессора
+void AccumulateScores(const int32_t* document_ids, const float* term_freqs, size_t count, float inverse_document_freq, float* scores);
+
+//Имя выбранной версии, для логов и отладки
+const char* GetScoringKernelName();
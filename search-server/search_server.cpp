@@ -2,11 +2,38 @@
 
 
 
-SearchServer::SearchServer(const std::string_view stop_words_text)
-  :SearchServer(SplitIntoWords(stop_words_text)){}
-
-SearchServer::SearchServer(const std::string& stop_words_text)
-  :SearchServer(SplitIntoWords(stop_words_text)){}
+SearchServer::SearchServer(const std::string_view stop_words_text, const SearchServerOptions& options)
+  :SearchServer(SplitIntoWords(stop_words_text), options){}
+
+SearchServer::SearchServer(const std::string& stop_words_text, const SearchServerOptions& options)
+  :SearchServer(SplitIntoWords(stop_words_text), options){}
+
+SearchServer::SearchServer(const SearchServer& other)
+  : stop_words_(other.stop_words_)
+  , document_store_(other.document_store_)
+  , impact_index_(other.impact_index_ != nullptr ? std::make_unique<ImpactIndex>() : nullptr)
+  , positions_(other.positions_ != nullptr ? std::make_unique<PositionIndex>(*other.positions_) : nullptr)
+  , scoring_index_(other.scoring_index_ != nullptr ? std::make_unique<ScoringIndex>() : nullptr)
+  , memory_budget_bytes_(other.memory_budget_bytes_)
+  , forced_strategy_(other.forced_strategy_)
+  , next_compaction_bytes_(other.next_compaction_bytes_)
+  , status_counts_(other.status_counts_)
+{
+  for (const auto& [word, document_freqs] : other.word_to_document_freqs_) {
+      const std::string_view stored_word = InternWord(word);
+      word_to_document_freqs_[stored_word].insert(document_freqs.begin(), document_freqs.end());
+      MarkWordChanged(stored_word);
+  }
+  for (const auto& [document_id, word_freqs] : other.id_words_freg_) {
+      auto& stored_freqs = id_words_freg_[document_id];
+      for (const auto& [word, term_freq] : word_freqs) {
+          stored_freqs.emplace_hint(stored_freqs.end(), *words_.find(word), term_freq);
+      }
+  }
+  documents_.insert(other.documents_.begin(), other.documents_.end());
+  set_id_.insert(other.set_id_.begin(), other.set_id_.end());
+  ratings_.insert(other.ratings_.begin(), other.ratings_.end());
+}
 
 //Проверка слова на валидность и отсутствие недопустимых символов
 bool SearchServer::IsValidWord(const std::string_view word) {
@@ -29,27 +56,156 @@ int SearchServer::ComputeAverageRating(const std::vector<int>& ratings) {
 
 //Добавление документа
 void SearchServer::AddDocument(int document_id, const std::string_view document, DocumentStatus status, const std::vector<int>& ratings) {
-  if ((document_id < 0) || (documents_.count(document_id) > 0)) {
+  //id документа, ждущего PublishDocuments, тоже занят
+  if ((document_id < 0) || (documents_.count(document_id) > 0) || ingest_buffer_->IsClaimed(document_id)) {
       throw std::invalid_argument("Invalid document_id");
   }
 
-  documents_.emplace(document_id, DocumentData{ComputeAverageRating(ratings), status, std::string(document)});
-
-  const auto words = SplitIntoWordsNoStop(documents_[document_id].data);
+  const auto words = SplitIntoWordsNoStop(document);
+  const int rating = ComputeAverageRating(ratings);
+  documents_.emplace(document_id, DocumentData{rating, status, document_store_.Add(document)});
+  ratings_.insert({status, rating, document_id});
+  ++status_counts_[static_cast<int>(status)];
 
   const double inv_word_count = 1.0 / words.size();
   for (const std::string_view word : words) {
-      //std::cout << "Добавление документа " << word << std::endl;
-      word_to_document_freqs_[word][document_id] += inv_word_count;
+      //Слова документа ссылаются на общий словарь, а не на текст, поэтому текст можно не хранить
+      const std::string_view stored_word = InternWord(word);
+      word_to_document_freqs_[stored_word][document_id] += inv_word_count;
       // Мапа хранящие айди документов, слова и частоту их упоминания в запросе
-      id_words_freg_[document_id][word] += inv_word_count;
+      id_words_freg_[document_id][stored_word] += inv_word_count;
+      MarkWordChanged(stored_word);
+  }
+  if (positions_ != nullptr) {
+      positions_->Add(document_id, BuildPositionStream(document));
   }
 
   //for(auto [key, val] : word_to_document_freqs_) std::cout << "Добавленые " << key << std::endl;
   //for(auto [key, val] : documents_) std::cout << "Данные документа " << val.data << std::endl;
   set_id_.insert(document_id);
+  EnforceMemoryBudget();
+}
+
+
+bool SearchServer::HasDocument(int document_id) const {
+  return documents_.count(document_id) > 0 || ingest_buffer_->IsClaimed(document_id);
+}
+
+void SearchServer::CheckDocumentText(const std::string_view document) {
+  for (const std::string_view word : SplitIntoWords(document)) {
+      if (!IsValidWord(word)) {
+          throw std::invalid_argument("Word " + std::string(word) + " is invalid");
+      }
+  }
+}
+
+void SearchServer::AddDocument(std::execution::parallel_policy, int document_id, const std::string_view document, DocumentStatus status, const std::vector<int>& ratings) {
+  std::shared_lock<std::shared_mutex> lock(ingest_buffer_->GetPublishMutex());
+  if (document_id < 0 || documents_.count(document_id) > 0) {
+      throw std::invalid_argument("Invalid document_id");
+  }
+  //Всё, что может бросить, готовится до захвата id: иначе id остался бы занятым, а место — заполненным наполовину
+  const auto words = SplitIntoWordsNoStop(document);
+  const int rating = ComputeAverageRating(ratings);
+  std::string text(document);
+  std::string positions = positions_ != nullptr ? BuildPositionStream(document) : std::string();
+
+  //Частоты копятся так же, как в AddDocument, чтобы значения совпадали до бита.
+  //Слова ссылаются в document, в text они переставляются после переноса текста на место
+  std::map<std::string_view, double> word_freqs_by_word;
+  const double inv_word_count = 1.0 / words.size();
+  for (const std::string_view word : words) {
+      word_freqs_by_word[word] += inv_word_count;
+  }
+  std::vector<std::pair<std::string_view, double>> word_freqs(word_freqs_by_word.begin(), word_freqs_by_word.end());
+
+  if (!ingest_buffer_->ClaimId(document_id)) {
+      throw std::invalid_argument("Invalid document_id");
+  }
+  uint32_t slot = 0;
+  IngestBuffer::StagedDocument* staged = nullptr;
+  try {
+      std::tie(slot, staged) = ingest_buffer_->AllocateSlot();
+  } catch (...) {
+      ingest_buffer_->ReleaseId(document_id);
+      throw;
+  }
+  //Дальше до AddPostings только переносы, они не бросают
+  staged->id = document_id;
+  staged->rating = rating;
+  staged->status = status;
+  staged->text = std::move(text);
+  for (auto& [word, _] : word_freqs) {
+      word = std::string_view(staged->text.data() + (word.data() - document.data()), word.size());
+  }
+  staged->word_freqs = std::move(word_freqs);
+  staged->positions = std::move(positions);
+  try {
+      ingest_buffer_->AddPostings(slot, *staged);
+  } catch (...) {
+      ingest_buffer_->ReleaseId(document_id);
+      throw;
+  }
 }
 
+size_t SearchServer::PublishDocuments() {
+  std::unique_lock<std::shared_mutex> lock(ingest_buffer_->GetPublishMutex());
+  const size_t count = ingest_buffer_->GetDocumentCount();
+  if (count == 0) {
+      return 0;
+  }
+
+  //Новые узлы мап создаются последовательно, заполнение списков идёт параллельно:
+  //список слова и слова документа принадлежат одной задаче
+  std::vector<DocumentToWordFreqs::mapped_type*> forward(count, nullptr);
+  size_t published = 0;
+  for (uint32_t slot = 0; slot < count; ++slot) {
+      const auto& staged = ingest_buffer_->GetDocument(slot);
+      if (staged.discarded) {
+          continue;
+      }
+      ++published;
+      documents_.emplace(staged.id, DocumentData{staged.rating, staged.status, document_store_.Add(staged.text)});
+      ratings_.insert({staged.status, staged.rating, staged.id});
+      ++status_counts_[static_cast<int>(staged.status)];
+      set_id_.insert(staged.id);
+      if (positions_ != nullptr) {
+          positions_->Add(staged.id, staged.positions);
+      }
+      if (!staged.word_freqs.empty()) {
+          forward[slot] = &id_words_freg_[staged.id];
+      }
+  }
+
+  std::vector<std::pair<DocumentFreqs*, const std::vector<IngestBuffer::Posting>*>> terms;
+  ingest_buffer_->ForEachTerm([this, &terms](const std::string_view word, const std::vector<IngestBuffer::Posting>& postings) {
+      const std::string_view stored_word = InternWord(word);
+      terms.push_back({&word_to_document_freqs_[stored_word], &postings});
+      MarkWordChanged(stored_word);
+  });
+
+  std::for_each(std::execution::par, terms.begin(), terms.end(), [this](const auto& term) {
+      const auto& [document_freqs, postings] = term;
+      for (const auto& posting : *postings) {
+          document_freqs->emplace(ingest_buffer_->GetDocument(posting.slot).id, posting.term_freq);
+      }
+  });
+
+  std::vector<uint32_t> slots(count);
+  std::iota(slots.begin(), slots.end(), 0);
+  std::for_each(std::execution::par, slots.begin(), slots.end(), [this, &forward](uint32_t slot) {
+      if (forward[slot] == nullptr) {
+          return;
+      }
+      for (const auto& [word, term_freq] : ingest_buffer_->GetDocument(slot).word_freqs) {
+          forward[slot]->emplace_hint(forward[slot]->end(), *words_.find(word), term_freq);
+      }
+  });
+
+  ingest_buffer_->Clear();
+  EnforceMemoryBudget();
+  return published;
+}
 
 //Удаление документа
 void SearchServer::RemoveDocument(const int document_id){
@@ -57,8 +213,16 @@ void SearchServer::RemoveDocument(const int document_id){
     for(const auto [key, _] : id_words_freg_[document_id]){
         auto remove_freqs_word = word_to_document_freqs_[key].find(document_id);
         word_to_document_freqs_[key].erase(remove_freqs_word);
+        MarkWordChanged(key);
     }
     //auto remove_iter_doc = documents_.find(document_id);
+    const auto& document_data = documents_.at(document_id);
+    ratings_.erase({document_data.status, document_data.rating, document_id});
+    --status_counts_[static_cast<int>(document_data.status)];
+    document_store_.Remove(document_data.text);
+    if (positions_ != nullptr) {
+        positions_->Remove(document_id);
+    }
     documents_.erase(documents_.find(document_id));
     set_id_.erase(set_id_.find(document_id));
     id_words_freg_.erase(id_words_freg_.find(document_id));
@@ -70,33 +234,24 @@ void SearchServer::RemoveDocument(std::execution::sequenced_policy, int document
 }
 
 void SearchServer::RemoveDocument(std::execution::parallel_policy, int document_id){
-  if(documents_.count(document_id)){
-    std::vector<std::string> keywords(id_words_freg_[document_id].size());
-    size_t counter = 0;
-    std::for_each(std::execution::par, id_words_freg_[document_id].begin(),
-                  id_words_freg_[document_id].end(),
-                  [&counter, &keywords](const auto& rhs) {
-                    keywords[counter] = rhs.first;
-                    ++counter;});
-
-    std::for_each(std::execution::par,
-                  keywords.begin(),
-                  keywords.end(),
-                  [&](const std::string& word) {
-                  word_to_document_freqs_[word].erase(document_id);
-    });
+  RemoveDocuments(std::execution::par, std::vector<int>{document_id});
+}
 
-    documents_.erase(documents_.find(document_id));
-    set_id_.erase(set_id_.find(document_id));
-    id_words_freg_.erase(id_words_freg_.find(document_id));
-  }
+void SearchServer::RemoveDocuments(const std::vector<int>& document_ids) {
+  RemoveDocumentsImpl(std::execution::seq, document_ids);
+}
+
+void SearchServer::RemoveDocuments(std::execution::sequenced_policy, const std::vector<int>& document_ids) {
+  RemoveDocumentsImpl(std::execution::seq, document_ids);
+}
+
+void SearchServer::RemoveDocuments(std::execution::parallel_policy, const std::vector<int>& document_ids) {
+  RemoveDocumentsImpl(std::execution::par, document_ids);
 }
 
 //Поиск документов
 std::vector<Document> SearchServer::FindTopDocuments(std::execution::sequenced_policy, const std::string_view raw_query, DocumentStatus status) const {
-  return FindTopDocuments(std::execution::seq, raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-      return document_status == status;
-  });
+  return FindTopDocuments<MAX_RESULT_DOCUMENT_COUNT>(std::execution::seq, raw_query, status);
 }
 
 std::vector<Document> SearchServer::FindTopDocuments(std::execution::sequenced_policy,const std::string_view raw_query) const {
@@ -105,9 +260,7 @@ std::vector<Document> SearchServer::FindTopDocuments(std::execution::sequenced_p
 
 
 std::vector<Document> SearchServer::FindTopDocuments(const std::string_view raw_query, DocumentStatus status) const {
-  return FindTopDocuments(raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-      return document_status == status;
-  });
+  return FindTopDocuments<MAX_RESULT_DOCUMENT_COUNT>(std::execution::par, raw_query, status);
 }
 
 
@@ -118,9 +271,7 @@ std::vector<Document> SearchServer::FindTopDocuments(const std::string_view raw_
 
 
 std::vector<Document> SearchServer::FindTopDocuments(std::execution::parallel_policy, const std::string_view raw_query, DocumentStatus status) const {
-  return FindTopDocuments(raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-      return document_status == status;
-  });
+  return FindTopDocuments<MAX_RESULT_DOCUMENT_COUNT>(std::execution::par, raw_query, status);
 }
 std::vector<Document> SearchServer::FindTopDocuments(std::execution::parallel_policy,const std::string_view raw_query) const {
   return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
@@ -128,6 +279,167 @@ std::vector<Document> SearchServer::FindTopDocuments(std::execution::parallel_po
 
 
 
+std::vector<Document> SearchServer::FindTopDocuments(std::execution::sequenced_policy, const std::string_view raw_query, const DocumentFilter& filter) const {
+  return FindTopDocumentsWithFilter(std::execution::seq, raw_query, filter);
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(std::execution::parallel_policy, const std::string_view raw_query, const DocumentFilter& filter) const {
+  return FindTopDocumentsWithFilter(std::execution::par, raw_query, filter);
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(const std::string_view raw_query, const DocumentFilter& filter) const {
+  return FindTopDocumentsWithFilter(std::execution::par, raw_query, filter);
+}
+
+namespace {
+
+struct AllowedDocument {
+    int id;
+    int rating;
+};
+
+//Вызывает function(индекс в allowed, частота) для записей списка из allowed (allowed упорядочен по id).
+//Короткий allowed ищется в списке по одному, длинный сливается со списком
+template <typename Function>
+void ForEachAllowedPosting(const DocumentFreqs& postings, const std::vector<AllowedDocument>& allowed, Function function) {
+  if (allowed.size() * std::log2(postings.size() + 1.0) < postings.size()) {
+      for (size_t i = 0; i < allowed.size(); ++i) {
+          const auto posting = postings.find(allowed[i].id);
+          if (posting != postings.end()) {
+              function(i, posting->second);
+          }
+      }
+      return;
+  }
+
+  auto posting = postings.lower_bound(allowed.front().id);
+  size_t i = 0;
+  while (posting != postings.end() && i < allowed.size()) {
+      if (posting->first < allowed[i].id) {
+          ++posting;
+      } else if (allowed[i].id < posting->first) {
+          ++i;
+      } else {
+          function(i, posting->second);
+          ++posting;
+          ++i;
+      }
+  }
+}
+
+}  // namespace
+
+bool SearchServer::FindFilteredDocuments(const Query& query, const DocumentFilter& filter, std::vector<Document>& matched_documents,
+                                         const CancellationToken* token) const {
+  const auto check_cancelled = [token] {
+      if (token != nullptr && token->IsCancelled()) {
+          throw QueryCancelled();
+      }
+  };
+  size_t plus_postings = 0;
+  for (const QueryTerm& term : query.plus_words) {
+      if (term.postings != nullptr) {
+          plus_postings += term.postings->size();
+      }
+  }
+  //Только статусы: документы берутся из колонки рейтингов целыми отрезками статусов,
+  //если их меньше, чем записей в списках
+  const bool has_only_statuses = !filter.HasRatingRange() && !filter.HasDocumentIdRange();
+  if (has_only_statuses) {
+      size_t status_documents = 0;
+      for (int status = static_cast<int>(DocumentStatus::ACTUAL); status <= static_cast<int>(DocumentStatus::REMOVED); ++status) {
+          if ((filter.statuses & DocumentFilter::StatusBit(static_cast<DocumentStatus>(status))) != 0) {
+              status_documents += status_counts_[status];
+          }
+      }
+      //Фильтр, пропускающий все документы, векторное ядро проверяет только у кандидатов в топ
+      if (status_documents >= plus_postings || (scoring_index_ != nullptr && status_documents == documents_.size())) {
+          return false;
+      }
+  }
+  if (plus_postings == 0 || filter.min_rating > filter.max_rating || filter.min_document_id > filter.max_document_id) {
+      return true;
+  }
+
+  //Отбор прерывается, как только просмотрено больше документов, чем записей в списках
+  std::vector<AllowedDocument> allowed;
+  size_t scanned = 0;
+  if (filter.HasRatingRange() || has_only_statuses) {
+      for (int status = static_cast<int>(DocumentStatus::ACTUAL); status <= static_cast<int>(DocumentStatus::REMOVED); ++status) {
+          const auto document_status = static_cast<DocumentStatus>(status);
+          if ((filter.statuses & DocumentFilter::StatusBit(document_status)) == 0) {
+              continue;
+          }
+          auto it = ratings_.lower_bound({document_status, filter.min_rating, std::numeric_limits<int>::min()});
+          const auto last = ratings_.upper_bound({document_status, filter.max_rating, std::numeric_limits<int>::max()});
+          for (; it != last; ++it) {
+              if (++scanned > plus_postings) {
+                  return false;
+              }
+              if (scanned % CANCELLATION_CHECK_INTERVAL == 0) {
+                  check_cancelled();
+              }
+              const auto [_, rating, document_id] = *it;
+              if (filter.min_document_id <= document_id && document_id <= filter.max_document_id) {
+                  allowed.push_back({document_id, rating});
+              }
+          }
+      }
+      std::sort(allowed.begin(), allowed.end(), [](const AllowedDocument& lhs, const AllowedDocument& rhs) {
+          return lhs.id < rhs.id;
+      });
+  } else {
+      auto it = documents_.lower_bound(filter.min_document_id);
+      const auto last = documents_.upper_bound(filter.max_document_id);
+      for (; it != last; ++it) {
+          if (++scanned > plus_postings) {
+              return false;
+          }
+          if (scanned % CANCELLATION_CHECK_INTERVAL == 0) {
+              check_cancelled();
+          }
+          const auto& [document_id, document_data] = *it;
+          if (filter.Matches(document_id, document_data.status, document_data.rating)) {
+              allowed.push_back({document_id, document_data.rating});
+          }
+      }
+  }
+  if (allowed.empty()) {
+      return true;
+  }
+
+  //Порядок сложения по словам тот же, что в FindAllDocuments, поэтому и релевантность та же
+  std::vector<double> relevances(allowed.size(), 0.0);
+  std::vector<char> states(allowed.size(), 0);
+  const char MATCHED = 1;
+  const char EXCLUDED = 2;
+  //Отмена проверяется перед каждым словом: обход одного списка не длиннее отбора выше
+  for (const QueryTerm& term : query.plus_words) {
+      check_cancelled();
+      if (term.postings != nullptr) {
+          ForEachAllowedPosting(*term.postings, allowed, [&](size_t i, double term_freq) {
+              relevances[i] += term_freq * term.inverse_document_freq;
+              states[i] |= MATCHED;
+          });
+      }
+  }
+  for (const QueryTerm& term : query.minus_words) {
+      check_cancelled();
+      if (term.postings != nullptr) {
+          ForEachAllowedPosting(*term.postings, allowed, [&](size_t i, double) {
+              states[i] |= EXCLUDED;
+          });
+      }
+  }
+
+  for (size_t i = 0; i < allowed.size(); ++i) {
+      if (states[i] == MATCHED) {
+          matched_documents.push_back({allowed[i].id, relevances[i], allowed[i].rating});
+      }
+  }
+  return true;
+}
+
 int SearchServer::GetDocumentCount() const {
   return documents_.size();
 }
@@ -149,88 +461,274 @@ const std::map<std::string_view, double> SearchServer::GetWordFrequencies(int do
 }
 
 
-//Совпадающие слова в документах
-std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::string_view raw_query, int document_id) const {
-  std::string query_words = std::string(raw_query);
-
-  const auto query = ParseQuery(query_words);
-  std::vector<std::string_view> matched_words;
+bool SearchServer::HasMinusWord(const Query& query, int document_id) const {
+  for (const QueryTerm& term : query.minus_words) {
+      if (term.postings != nullptr && term.postings->count(document_id)) {
+          return true;
+      }
+  }
+  return false;
+}
 
-  for (const std::string_view word : query.minus_words) {
-      if (word_to_document_freqs_.count(word) == 0) {
+std::vector<int> SearchServer::CollectMinusDocuments(const Query& query) const {
+  std::vector<int> document_ids;
+  for (const QueryTerm& term : query.minus_words) {
+      if (term.postings == nullptr) {
           continue;
       }
-      if (word_to_document_freqs_.at(word).count(document_id)) {
-          matched_words.clear();
-          return {matched_words, documents_.at(document_id).status};
+      for (const auto& [document_id, _] : *term.postings) {
+          document_ids.push_back(document_id);
       }
   }
-
-  matched_words.reserve(query.plus_words.size());
-  std::for_each(query.plus_words.begin(), query.plus_words.end(), [this, &document_id, &matched_words](const auto rhs_str){
-  auto temp_doc = word_to_document_freqs_.find(rhs_str);
-    if(temp_doc != word_to_document_freqs_.end()){
-      if(temp_doc->second.count(document_id)){
-       matched_words.push_back(temp_doc->first);
-      }
-    }
+  if (query.minus_words.size() > 1) {
+      std::sort(document_ids.begin(), document_ids.end());
+      document_ids.erase(std::unique(document_ids.begin(), document_ids.end()), document_ids.end());
+  }
+  return document_ids;
+}
+
+std::string SearchServer::GetDocumentText(int document_id) const {
+  return document_store_.Get(documents_.at(document_id).text);
+}
+
+void SearchServer::ForEachDocumentText(const std::function<void(int document_id, std::string_view text)>& function) const {
+  std::vector<std::pair<DocumentStore::Location, int>> locations;
+  locations.reserve(documents_.size());
+  for (const auto& [document_id, document_data] : documents_) {
+      locations.push_back({document_data.text, document_id});
+  }
+  std::sort(locations.begin(), locations.end(), [](const auto& lhs, const auto& rhs) {
+      return std::tie(lhs.first.block, lhs.first.offset) < std::tie(rhs.first.block, rhs.first.offset);
   });
+  DocumentStore::Reader reader(document_store_);
+  for (const auto& [location, document_id] : locations) {
+      function(document_id, reader.Get(location));
+  }
+}
 
-  //matched_words.resize(index);
-  return {matched_words, documents_.at(document_id).status};
+DocumentStatus SearchServer::GetDocumentStatus(int document_id) const {
+  return documents_.at(document_id).status;
 }
 
-std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(std::execution::sequenced_policy, const std::string_view raw_query, int document_id) const {
-  return MatchDocument(raw_query, document_id);}
+int SearchServer::GetDocumentRating(int document_id) const {
+  return documents_.at(document_id).rating;
+}
 
-std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(std::execution::parallel_policy,const std::string_view raw_query, int document_id) const{
-  if (!documents_.count(document_id)) {
-  throw std::out_of_range("No valid id" + std::to_string(document_id));}
+MemoryStats SearchServer::GetMemoryStats() const {
+  MemoryStats stats;
+
+  stats.dictionary.bytes = memory_counters_->dictionary.bytes.load();
+  //Короткие слова лежат внутри std::string, длинные — в своём буфере, который аллокатор узлов не видит
+  for (const std::string& word : words_) {
+      if (word.capacity() > std::string().capacity()) {
+          stats.dictionary.bytes += word.capacity() + 1;
+      }
+  }
+  stats.dictionary.entries = word_to_document_freqs_.size();
+
+  stats.postings.bytes = memory_counters_->postings.bytes.load();
+  for (const auto& [_, postings] : word_to_document_freqs_) {
+      stats.postings.entries += postings.size();
+  }
+
+  stats.forward_index.bytes = memory_counters_->forward_index.bytes.load();
+  for (const auto& [_, words] : id_words_freg_) {
+      stats.forward_index.entries += words.size();
+  }
+
+  stats.documents.bytes = memory_counters_->documents.bytes.load();
+  stats.documents.entries = documents_.size();
+
+  stats.document_store.bytes = document_store_.GetStoredBytes();
+  stats.document_store.entries = document_store_.GetMode() == TextStorageMode::NONE ? 0 : documents_.size();
 
-  const auto query = ParseQueryVec(raw_query);
+  if (impact_index_ != nullptr) {
+      stats.caches.bytes = impact_index_->GetByteCount();
+      stats.caches.entries = impact_index_->GetPostingCount();
+  }
+  if (scoring_index_ != nullptr) {
+      stats.caches.bytes += scoring_index_->GetByteCount();
+      stats.caches.entries += scoring_index_->GetPostingCount();
+  }
+  if (positions_ != nullptr) {
+      stats.positions.bytes = positions_->GetByteCount();
+      stats.positions.entries = documents_.size();
+  }
+  return stats;
+}
+
+void SearchServer::CompactMemory() {
+  //Кэш корзин сбрасывается, а его слова помечаются изменёнными: списки перестроятся при следующем поиске.
+  //Массивы векторного подсчёта не сбрасываются: без них каждый запрос переводил бы списки заново,
+  //а на запись списка они тратят 8 байт против узла мапы в индексе
+  if (impact_index_ != nullptr) {
+      impact_index_->Clear();
+      for (const auto& [word, postings] : word_to_document_freqs_) {
+          if (postings.size() >= IMPACT_MIN_POSTINGS) {
+              impact_index_->MarkDirty(word);
+          }
+      }
+  }
+
+  //После удалений в индексе остаются слова без документов
+  for (auto it = word_to_document_freqs_.begin(); it != word_to_document_freqs_.end();) {
+      if (!it->second.empty()) {
+          ++it;
+          continue;
+      }
+      const std::string_view word = it->first;
+      EraseWordCaches(word);
+      it = word_to_document_freqs_.erase(it);
+      words_.erase(words_.find(word));
+  }
+
+  std::vector<DocumentStore::Location*> locations;
+  locations.reserve(documents_.size());
+  for (auto& [_, document_data] : documents_) {
+      locations.push_back(&document_data.text);
+  }
+  document_store_.Compact(locations);
+
+  if (positions_ != nullptr) {
+      positions_->Compact();
+  }
+}
+
+void SearchServer::MarkWordChanged(const std::string_view word) {
+  if (impact_index_ != nullptr) {
+      impact_index_->MarkDirty(word);
+  }
+  if (scoring_index_ != nullptr) {
+      scoring_index_->MarkDirty(word);
+  }
+}
+
+void SearchServer::EraseWordCaches(const std::string_view word) {
+  if (impact_index_ != nullptr) {
+      impact_index_->Erase(word);
+  }
+  if (scoring_index_ != nullptr) {
+      scoring_index_->Erase(word);
+  }
+}
+
+size_t SearchServer::GetTrackedBytes() const {
+  size_t bytes = memory_counters_->dictionary.bytes.load(std::memory_order_relaxed)
+                 + memory_counters_->postings.bytes.load(std::memory_order_relaxed)
+                 + memory_counters_->forward_index.bytes.load(std::memory_order_relaxed)
+                 + memory_counters_->documents.bytes.load(std::memory_order_relaxed)
+                 + document_store_.GetStoredBytes();
+  if (impact_index_ != nullptr) {
+      bytes += impact_index_->GetByteCount();
+  }
+  if (scoring_index_ != nullptr) {
+      bytes += scoring_index_->GetByteCount();
+  }
+  if (positions_ != nullptr) {
+      bytes += positions_->GetByteCount();
+  }
+  return bytes;
+}
+
+void SearchServer::EnforceMemoryBudget() {
+  if (memory_budget_bytes_ == 0) {
+      return;
+  }
+  const size_t bytes = GetTrackedBytes();
+  if (bytes <= memory_budget_bytes_ || bytes < next_compaction_bytes_) {
+      return;
+  }
+  CompactMemory();
+  //Следующая попытка только после роста на долю от текущего объёма, так что всё уплотнение вместе
+  //стоит не больше постоянной доли от добавления. Если уплотнение почти ничего не освободило,
+  //ждём удвоения
+  const size_t compacted = GetTrackedBytes();
+  if (bytes - std::min(bytes, compacted) < bytes / MIN_COMPACTION_GAIN_DIVISOR) {
+      next_compaction_bytes_ = 2 * compacted;
+  } else {
+      next_compaction_bytes_ = compacted + compacted / COMPACTION_GROWTH_DIVISOR;
+  }
+}
+
+std::string_view SearchServer::InternWord(const std::string_view word) {
+  const auto it = word_to_document_freqs_.find(word);
+  if (it != word_to_document_freqs_.end()) {
+      return it->first;
+  }
+  return *words_.emplace(word).first;
+}
+
+
+//Совпадающие слова в документах
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::string_view raw_query, int document_id) const {
+  return MatchDocument(ParseQuery(raw_query), document_id);
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const Query& query, int document_id,
+                                                                                     const CancellationToken* token) const {
+  //Отмена проверяется перед каждым словом: слово префикса может обойти много слов документа
+  const auto check_cancelled = [token] {
+      if (token != nullptr && token->IsCancelled()) {
+          throw QueryCancelled();
+      }
+  };
   std::vector<std::string_view> matched_words;
-    for (const auto word : query.minus_words){
-       auto temp_doc = word_to_document_freqs_.find(word);
-       if(temp_doc == word_to_document_freqs_.end()) {
+
+  for (const QueryTerm& term : query.minus_words) {
+      check_cancelled();
+      if (term.postings == nullptr) {
           continue;
       }
-      if (temp_doc->second.count(document_id)) {
-          matched_words.clear();
+      if (term.postings->count(document_id)) {
           return {matched_words, documents_.at(document_id).status};
       }
   }
 
-  matched_words.resize(query.plus_words.size());
-  size_t index = 0;
-
-  std::for_each(query.plus_words.begin(), query.plus_words.end(), [this, &document_id, &matched_words, &index](const auto rhs_str){
-  auto temp_doc = word_to_document_freqs_.find(rhs_str);
-    if(temp_doc != word_to_document_freqs_.end()){
-      if(temp_doc->second.count(document_id)){
-       matched_words[index] = temp_doc->first;
-       ++index;}
-      }
-   });
-
-  //Удаляю дубликаты
-  std::set<std::string_view> s;
-  for(unsigned i = 0; i < index; ++i) s.insert(matched_words[i]);
-  matched_words.resize(s.size());
-  index = 0;
-  for(auto w : s) {matched_words[index] = w; ++index;}
-  //copy(std::execution::par, s.begin(), s.end(), std::begin(matched_words));
+  matched_words.reserve(query.plus_words.size());
+  for (const QueryTerm& term : query.plus_words) {
+      check_cancelled();
+      if (term.postings == nullptr || !term.postings->count(document_id)) {
+          continue;
+      }
+      if (term.is_phrase) {
+          const auto& words = FindExpansion(query, term).words;
+          matched_words.insert(matched_words.end(), words.begin(), words.end());
+          continue;
+      }
+      if (!term.is_prefix) {
+          matched_words.push_back(term.word);
+          continue;
+      }
+      //Для префикса — слова документа с этим началом, вошедшие в список префикса
+      const auto& kept_words = FindExpansion(query, term).words;
+      const auto& words = id_words_freg_.at(document_id);
+      for (auto it = words.lower_bound(term.word); it != words.end() && it->first.substr(0, term.word.size()) == term.word; ++it) {
+          if (std::binary_search(kept_words.begin(), kept_words.end(), it->first)) {
+              matched_words.push_back(it->first);
+          }
+      }
+  }
+  if (query.HasExpandedTerms()) {
+      std::sort(matched_words.begin(), matched_words.end());
+      matched_words.erase(std::unique(matched_words.begin(), matched_words.end()), matched_words.end());
+  }
 
   return {matched_words, documents_.at(document_id).status};
 }
 
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(std::execution::sequenced_policy, const std::string_view raw_query, int document_id) const {
+  return MatchDocument(raw_query, document_id);}
 
+//Слова запроса уже без повторов, так что отдельная параллельная версия не нужна
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(std::execution::parallel_policy,const std::string_view raw_query, int document_id) const{
+  if (!documents_.count(document_id)) {
+  throw std::out_of_range("No valid id" + std::to_string(document_id));}
 
-//Если есть в стоп словах
-bool SearchServer::IsStopWord(const std::string_view word) const {
-  return stop_words_.count(word) > 0;
+  return MatchDocument(raw_query, document_id);
 }
 
 
+
 //Переделка строки в вектор без стоп слов
 std::vector<std::string_view> SearchServer::SplitIntoWordsNoStop(const std::string_view text) const {
   std::vector<std::string_view> words;
@@ -256,50 +754,459 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(const std::string_view text
       is_minus = true;
       word = word.substr(1);
   }
+  //"word*" — все слова, начинающиеся с word
+  bool is_prefix = false;
+  if (!word.empty() && word.back() == '*') {
+      is_prefix = true;
+      word.remove_suffix(1);
+  }
   if (word.empty() ||  word[0] == '-' || !IsValidWord(word)) {
       throw std::invalid_argument("Query word " + std::string(text) + " is invalid");
   }
 
-  return {word, is_minus, IsStopWord(word)};
+  return {word, is_minus, !is_prefix && IsStopWord(word), is_prefix};
 }
 
 SearchServer::Query SearchServer::ParseQuery(const std::string_view text) const {
   Query result;
+  ParseQuery(text, result);
+  return result;
+}
 
-  for (const std::string_view word : SplitIntoWords(text)) {
+void SearchServer::ParseQuery(const std::string_view text, Query& query) const {
+  query.plus_words.clear();
+  query.minus_words.clear();
+  query.expansions.clear();
+
+  //Фраза — слова между кавычками: "white cat" или -"white cat"
+  const char* phrase_begin = nullptr;
+  bool is_minus_phrase = false;
+  const auto add_phrase = [this, &query, &phrase_begin, &is_minus_phrase](const char* phrase_end) {
+      const std::string_view phrase(phrase_begin, phrase_end - phrase_begin);
+      phrase_begin = nullptr;
+      std::string_view first_word;
+      size_t word_count = 0;
+      ForEachWord(phrase, [this, &first_word, &word_count](const std::string_view word) {
+          if (!IsValidWord(word)) {
+              throw std::invalid_argument("Query word " + std::string(word) + " is invalid");
+          }
+          if (!IsStopWord(word) && word_count++ == 0) {
+              first_word = word;
+          }
+      });
+      if (phrase.find_first_not_of(' ') == std::string_view::npos) {
+          throw std::invalid_argument("Query phrase is empty");
+      }
+      if (word_count == 0) {
+          return;
+      }
+      //Фраза из одного слова (без стоп-слов) — обычное слово
+      auto& words = is_minus_phrase ? query.minus_words : query.plus_words;
+      if (word_count == 1) {
+          words.push_back({first_word, nullptr, 0.0});
+      } else {
+          words.push_back({phrase, nullptr, 0.0, false, true});
+      }
+  };
+
+  //Без позиций фраз нет, и кавычка — обычный символ слова, как в тексте документов
+  const bool has_phrases = positions_ != nullptr;
+  ForEachWord(text, [this, &query, &phrase_begin, &is_minus_phrase, &add_phrase, has_phrases](std::string_view word) {
+      if (has_phrases && phrase_begin == nullptr && (word[0] == '"' || (word.size() > 1 && word[0] == '-' && word[1] == '"'))) {
+          is_minus_phrase = word[0] == '-';
+          word.remove_prefix(is_minus_phrase ? 2 : 1);
+          phrase_begin = word.data();
+          if (word.empty()) {
+              return;
+          }
+      }
+      //Кавычка бывает только в начале или в конце фразы: cat" и "cat одинаково незакрыты
+      if (has_phrases && word.substr(0, word.size() - (phrase_begin != nullptr ? 1 : 0)).find('"') != std::string_view::npos) {
+          throw std::invalid_argument("Query word " + std::string(word) + " has an unpaired quote");
+      }
+      if (phrase_begin != nullptr) {
+          if (word.back() == '"') {
+              add_phrase(word.data() + word.size() - 1);
+          }
+          return;
+      }
       const auto query_word = ParseQueryWord(word);
       if (!query_word.is_stop) {
           if (query_word.is_minus) {
-              result.minus_words.insert(query_word.data);
+              query.minus_words.push_back({query_word.data, nullptr, 0.0, query_word.is_prefix});
           } else {
-              result.plus_words.insert(query_word.data);
+              query.plus_words.push_back({query_word.data, nullptr, 0.0, query_word.is_prefix});
           }
       }
+  });
+  if (phrase_begin != nullptr) {
+      throw std::invalid_argument("Query phrase is not closed");
   }
-  return result;
+
+  ResolveQueryWords(query.plus_words, query.expansions, false);
+  ResolveQueryWords(query.minus_words, query.expansions, true);
 }
 
-SearchServer::VecQuery SearchServer::ParseQueryVec(const std::string_view text) const {
-  VecQuery result;
-  auto temp = SplitIntoWords(text);
-  result.minus_words.reserve(temp.size());
-  result.plus_words.reserve(temp.size());
+void SearchServer::ResolveQueryWords(SmallVector<QueryTerm, QUERY_INLINE_WORD_COUNT>& words,
+                                     std::vector<std::shared_ptr<const ExpandedTerm>>& expansions, bool is_minus) const {
+  std::sort(words.begin(), words.end(), [](const QueryTerm& lhs, const QueryTerm& rhs) {
+      return std::tie(lhs.word, lhs.is_prefix, lhs.is_phrase) < std::tie(rhs.word, rhs.is_prefix, rhs.is_phrase);
+  });
+  const auto last = std::unique(words.begin(), words.end(), [](const QueryTerm& lhs, const QueryTerm& rhs) {
+      return lhs.word == rhs.word && lhs.is_prefix == rhs.is_prefix && lhs.is_phrase == rhs.is_phrase;
+  });
+  words.resize_down(last - words.begin());
+
+  for (QueryTerm& term : words) {
+      if (term.is_prefix || term.is_phrase) {
+          //Исключение не ограничивается: иначе документ со словом вне самых частых прошёл бы мимо минус-слова
+          auto expansion = term.is_prefix ? ExpandPrefix(term.word, is_minus ? std::numeric_limits<size_t>::max() : MAX_PREFIX_EXPANSIONS)
+                                          : ExpandPhrase(term.word);
+          if (!expansion->postings.empty()) {
+              term.word = expansion->text;
+              term.postings = &expansion->postings;
+              term.inverse_document_freq = ComputeWordInverseDocumentFreq(GetDocumentCount(), expansion->postings.size());
+              expansions.push_back(std::move(expansion));
+          }
+          continue;
+      }
+      const auto it = word_to_document_freqs_.find(term.word);
+      if (it != word_to_document_freqs_.end() && !it->second.empty()) {
+          //Храним слово из индекса, чтобы оно не зависело от строки запроса
+          term.word = it->first;
+          term.postings = &it->second;
+          term.inverse_document_freq = ComputeWordInverseDocumentFreq(GetDocumentCount(), it->second.size());
+      }
+  }
+}
 
-  for (const auto word : temp) {
-      const auto query_word = ParseQueryWord(word);
-      if (!query_word.is_stop) {
-          if (query_word.is_minus) {
-              result.minus_words.push_back(query_word.data);
+std::vector<std::pair<std::string_view, size_t>> SearchServer::GetPrefixWordCounts(const std::string_view prefix) const {
+  //Слова с общим началом идут в словаре подряд
+  std::vector<std::pair<std::string_view, size_t>> words;
+  for (auto it = word_to_document_freqs_.lower_bound(prefix);
+       it != word_to_document_freqs_.end() && it->first.substr(0, prefix.size()) == prefix; ++it) {
+      if (!it->second.empty()) {
+          words.push_back({it->first, it->second.size()});
+      }
+  }
+  return words;
+}
+
+void SearchServer::RestrictPrefix(Query& query, const std::string_view prefix, const std::vector<std::string_view>& words) const {
+  const auto term = std::find_if(query.plus_words.begin(), query.plus_words.end(), [prefix](const QueryTerm& term) {
+      return term.is_prefix && term.word == prefix;
+  });
+  if (term == query.plus_words.end()) {
+      return;
+  }
+  std::vector<std::pair<std::string_view, const DocumentFreqs*>> lists;
+  for (const std::string_view word : words) {
+      const auto it = word_to_document_freqs_.find(word);
+      if (it != word_to_document_freqs_.end() && !it->second.empty()) {
+          lists.push_back({it->first, &it->second});
+      }
+  }
+  auto expansion = MergePrefixLists(prefix, lists);
+
+  //Старое раскрытие владеет текстом слова, поэтому слово переставляется на новое
+  const auto old_expansion = std::find_if(query.expansions.begin(), query.expansions.end(), [&term](const auto& expansion) {
+      return &expansion->postings == term->postings;
+  });
+  if (expansion->postings.empty()) {
+      //Старое раскрытие остаётся в запросе только как владелец текста слова
+      term->postings = nullptr;
+      term->inverse_document_freq = 0.0;
+      return;
+  }
+  term->word = expansion->text;
+  term->postings = &expansion->postings;
+  term->inverse_document_freq = ComputeWordInverseDocumentFreq(GetDocumentCount(), expansion->postings.size());
+  if (old_expansion != query.expansions.end()) {
+      *old_expansion = std::move(expansion);
+  } else {
+      query.expansions.push_back(std::move(expansion));
+  }
+}
+
+std::shared_ptr<const SearchServer::ExpandedTerm> SearchServer::ExpandPrefix(const std::string_view prefix, size_t max_words) const {
+  auto words = GetPrefixWordCounts(prefix);
+  SelectPrefixWords(words, max_words);
+  std::vector<std::pair<std::string_view, const DocumentFreqs*>> lists;
+  lists.reserve(words.size());
+  for (const auto& [word, _] : words) {
+      lists.push_back({word, &word_to_document_freqs_.find(word)->second});
+  }
+  return MergePrefixLists(prefix, lists);
+}
+
+std::shared_ptr<const SearchServer::ExpandedTerm> SearchServer::MergePrefixLists(
+    const std::string_view prefix, const std::vector<std::pair<std::string_view, const DocumentFreqs*>>& lists) const {
+  auto expansion = std::make_shared<ExpandedTerm>();
+  expansion->text = std::string(prefix);
+  expansion->word_count = lists.size();
+  expansion->words.reserve(lists.size());
+  for (const auto& [word, _] : lists) {
+      expansion->words.push_back(word);
+  }
+
+  //Слияние по возрастанию id: в вершине кучи список с наименьшим текущим документом.
+  //Частоты одного документа складываются по возрастанию слова, так что сумма не зависит от остальных слов словаря
+  struct Cursor {
+      DocumentFreqs::const_iterator it;
+      DocumentFreqs::const_iterator end;
+      size_t index;
+  };
+  const auto cursor_greater = [](const Cursor& lhs, const Cursor& rhs) {
+      return std::tie(lhs.it->first, lhs.index) > std::tie(rhs.it->first, rhs.index);
+  };
+  std::vector<Cursor> heap;
+  heap.reserve(lists.size());
+  for (const auto& [_, list] : lists) {
+      heap.push_back({list->begin(), list->end(), heap.size()});
+  }
+  std::make_heap(heap.begin(), heap.end(), cursor_greater);
+
+  DocumentFreqs& postings = expansion->postings;
+  while (!heap.empty()) {
+      std::pop_heap(heap.begin(), heap.end(), cursor_greater);
+      Cursor& cursor = heap.back();
+      const auto [document_id, term_freq] = *cursor.it;
+      if (!postings.empty() && std::prev(postings.end())->first == document_id) {
+          std::prev(postings.end())->second += term_freq;
+      } else {
+          postings.emplace_hint(postings.end(), document_id, term_freq);
+      }
+      if (++cursor.it == cursor.end) {
+          heap.pop_back();
+      } else {
+          std::push_heap(heap.begin(), heap.end(), cursor_greater);
+      }
+  }
+  return expansion;
+}
+
+std::shared_ptr<const SearchServer::ExpandedTerm> SearchServer::ExpandPhrase(const std::string_view phrase) const {
+  if (positions_ == nullptr) {
+      throw std::invalid_argument("Phrase queries need SearchServerOptions::positional_index");
+  }
+  auto expansion = std::make_shared<ExpandedTerm>();
+
+  //Стоп-слова занимают позицию, но не проверяются; смещения — от первого слова фразы
+  struct PhraseWord {
+      std::string_view word;
+      const DocumentFreqs* postings;
+      uint32_t offset;
+      //Номер среди разных слов фразы
+      size_t index;
+  };
+  std::vector<PhraseWord> phrase_words;
+  uint32_t offset = 0;
+  bool is_missing = false;
+  ForEachWord(phrase, [&](const std::string_view word) {
+      expansion->text += expansion->text.empty() ? "" : " ";
+      expansion->text += word;
+      const uint32_t word_offset = offset++;
+      if (IsStopWord(word)) {
+          return;
+      }
+      const auto it = word_to_document_freqs_.find(word);
+      if (it == word_to_document_freqs_.end() || it->second.empty()) {
+          is_missing = true;
+          return;
+      }
+      phrase_words.push_back({it->first, &it->second, word_offset, 0});
+  });
+  if (is_missing) {
+      return expansion;
+  }
+
+  auto& words = expansion->words;
+  for (const PhraseWord& phrase_word : phrase_words) {
+      words.push_back(phrase_word.word);
+  }
+  std::sort(words.begin(), words.end());
+  words.erase(std::unique(words.begin(), words.end()), words.end());
+  expansion->word_count = words.size();
+  const uint32_t first_offset = phrase_words.front().offset;
+  for (PhraseWord& phrase_word : phrase_words) {
+      phrase_word.offset -= first_offset;
+      phrase_word.index = std::lower_bound(words.begin(), words.end(), phrase_word.word) - words.begin();
+  }
+
+  //Кандидаты — документы самого короткого списка, которые есть в списках остальных слов
+  const auto shortest = std::min_element(phrase_words.begin(), phrase_words.end(), [](const PhraseWord& lhs, const PhraseWord& rhs) {
+      return lhs.postings->size() < rhs.postings->size();
+  });
+  std::vector<std::vector<uint32_t>> positions(words.size());
+  for (const auto [document_id, _] : *shortest->postings) {
+      const bool has_all_words = std::all_of(phrase_words.begin(), phrase_words.end(), [document_id = document_id](const PhraseWord& phrase_word) {
+          return phrase_word.postings->count(document_id) > 0;
+      });
+      if (!has_all_words) {
+          continue;
+      }
+
+      //Записи потока идут в порядке прямого индекса, поэтому их можно пройти вместе с ним
+      const auto& document_words = id_words_freg_.at(document_id);
+      auto reader = positions_->GetReader(document_id);
+      size_t next = 0;
+      for (auto it = document_words.begin(); it != document_words.end() && next < words.size(); ++it) {
+          if (it->first == words[next]) {
+              reader.Read(positions[next++]);
           } else {
-              result.plus_words.push_back(query_word.data);
+              reader.Skip();
           }
       }
+
+      size_t occurrences = 0;
+      for (const uint32_t position : positions[phrase_words.front().index]) {
+          const bool is_match = std::all_of(phrase_words.begin() + 1, phrase_words.end(), [&positions, position](const PhraseWord& phrase_word) {
+              const auto& word_positions = positions[phrase_word.index];
+              return std::binary_search(word_positions.begin(), word_positions.end(), position + phrase_word.offset);
+          });
+          occurrences += is_match ? 1 : 0;
+      }
+      if (occurrences == 0) {
+          continue;
+      }
+      //Частота фразы — число вхождений на слово документа, как у обычных слов
+      const std::vector<uint32_t>& first_positions = positions[phrase_words.front().index];
+      const double term_freq = phrase_words.front().postings->at(document_id) / first_positions.size() * occurrences;
+      expansion->postings.emplace_hint(expansion->postings.end(), document_id, term_freq);
+  }
+  return expansion;
+}
+
+std::string SearchServer::BuildPositionStream(const std::string_view document) const {
+  std::map<std::string_view, std::vector<uint32_t>> word_positions;
+  uint32_t position = 0;
+  ForEachWord(document, [this, &word_positions, &position](const std::string_view word) {
+      if (!IsStopWord(word)) {
+          word_positions[word].push_back(position);
+      }
+      ++position;
+  });
+
+  std::string stream;
+  for (const auto& [_, positions] : word_positions) {
+      PositionIndex::AppendWordPositions(stream, positions);
+  }
+  return stream;
+}
+
+size_t SearchServer::GetMatchCapacity(const Query& query, size_t document_word_count) const {
+  //Префикс совпадает не больше чем с оставленными словами и со всеми словами документа
+  size_t capacity = 0;
+  for (const QueryTerm& term : query.plus_words) {
+      if (term.is_prefix) {
+          capacity += term.postings == nullptr ? 0 : std::min(document_word_count, FindExpansion(query, term).word_count);
+      } else if (term.is_phrase && term.postings != nullptr) {
+          capacity += FindExpansion(query, term).word_count;
+      } else {
+          ++capacity;
+      }
+  }
+  return capacity;
+}
+
+const SearchServer::ExpandedTerm& SearchServer::FindExpansion(const Query& query, const QueryTerm& term) {
+  for (const auto& expansion : query.expansions) {
+      if (&expansion->postings == term.postings) {
+          return *expansion;
+      }
   }
-  return result;
+  throw std::logic_error("Query term " + std::string(term.word) + " has no expansion");
+}
 
+bool SearchServer::IsZeroContributionTerm(const QueryTerm& term) const {
+  return term.postings != nullptr && term.inverse_document_freq == 0.0
+         && term.postings->size() == static_cast<size_t>(GetDocumentCount());
 }
 
-double SearchServer::ComputeWordInverseDocumentFreq(const std::string_view word) const {
-    return std::log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(word).size());
+SearchServer::QueryPlan SearchServer::PlanQuery(const Query& query) const {
+  QueryPlan plan;
+  size_t plus_postings = 0;
+  size_t minus_postings = 0;
+  size_t lists = 0;
+
+  for (const QueryTerm& term : query.minus_words) {
+      const size_t document_count = term.postings == nullptr ? 0 : term.postings->size();
+      plan.steps.push_back({term.word, document_count, term.inverse_document_freq, true, term.postings == nullptr, term.is_prefix, term.is_phrase});
+      if (term.postings != nullptr) {
+          minus_postings += document_count;
+          ++lists;
+      }
+  }
+  //Плюс-слова идут в порядке запроса, см. QueryPlan::steps
+  for (const QueryTerm& term : query.plus_words) {
+      const size_t document_count = term.postings == nullptr ? 0 : term.postings->size();
+      const bool is_zero = IsZeroContributionTerm(term);
+      plan.steps.push_back({term.word, document_count, term.inverse_document_freq, false, term.postings == nullptr || is_zero, term.is_prefix, term.is_phrase});
+      if (is_zero) {
+          plan.matches_all_documents = true;
+      } else if (term.postings != nullptr) {
+          plus_postings += document_count;
+          ++lists;
+      }
+  }
+
+  //Слово за словом: каждая запись индекса — поиск в мапе кандидатов.
+  //По документам: каждый кандидат сравнивается со всеми списками
+  const double candidates = static_cast<double>(std::min(plus_postings, static_cast<size_t>(GetDocumentCount())));
+  plan.term_at_a_time_cost = (plus_postings + minus_postings) * std::log2(candidates + 2);
+  plan.document_at_a_time_cost = candidates * lists + minus_postings;
+  plan.strategy = plan.document_at_a_time_cost < plan.term_at_a_time_cost ? QueryStrategy::DOCUMENT_AT_A_TIME : QueryStrategy::TERM_AT_A_TIME;
+  if (forced_strategy_) {
+      plan.strategy = *forced_strategy_;
+  }
+  return plan;
 }
 
+void SearchServer::ForceQueryStrategy(std::optional<QueryStrategy> strategy) {
+  forced_strategy_ = strategy;
+}
+
+SearchServer::QueryPlan SearchServer::ExplainQuery(const std::string_view raw_query) const {
+  const auto query = ParseQuery(raw_query);
+  QueryPlan plan = PlanQuery(query);
+  plan.expansions = query.expansions;
+  return plan;
+}
+
+std::ostream& operator<<(std::ostream& out, const SearchServer::QueryPlan& plan) {
+  out << (plan.strategy == SearchServer::QueryStrategy::DOCUMENT_AT_A_TIME ? "document-at-a-time" : "term-at-a-time")
+      << " (cost " << plan.term_at_a_time_cost << " term-at-a-time, " << plan.document_at_a_time_cost << " document-at-a-time)";
+  if (plan.matches_all_documents) {
+      out << ", all documents match";
+  }
+  for (const auto& step : plan.steps) {
+      out << "\n  " << (step.is_minus ? "-" : "+") << (step.is_phrase ? "\"" : "") << step.word << (step.is_prefix ? "*" : "")
+          << (step.is_phrase ? "\"" : "") << " documents=" << step.document_count
+          << " idf=" << step.inverse_document_freq << (step.is_dropped ? " dropped" : "");
+  }
+  return out;
+}
+
+double SearchServer::ComputeWordInverseDocumentFreq(int document_count, size_t word_document_count) {
+    return std::log(document_count * 1.0 / word_document_count);
+}
+
+SearchServer::MatchedDocuments SearchServer::MatchDocuments(const std::string_view raw_query, const std::vector<int>& document_ids) const {
+  MatchedDocuments result;
+  MatchDocuments(std::execution::seq, raw_query, document_ids, result);
+  return result;
+}
+
+SearchServer::MatchedDocuments SearchServer::MatchDocuments(std::execution::parallel_policy, const std::string_view raw_query, const std::vector<int>& document_ids) const {
+  MatchedDocuments result;
+  MatchDocuments(std::execution::par, raw_query, document_ids, result);
+  return result;
+}
+
+void SearchServer::MatchDocuments(std::execution::sequenced_policy, const std::string_view raw_query, const std::vector<int>& document_ids, MatchedDocuments& result) const {
+  MatchDocumentsImpl(std::execution::seq, raw_query, document_ids, result);
+}
+
+void SearchServer::MatchDocuments(std::execution::parallel_policy, const std::string_view raw_query, const std::vector<int>& document_ids, MatchedDocuments& result) const {
+  MatchDocumentsImpl(std::execution::par, raw_query, document_ids, result);
+}
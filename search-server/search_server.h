@@ -14,39 +14,194 @@
 #include <string_view>
 #include <functional>
 #include "concurrent_map.h"
+#include "small_vector.h"
+#include "cancellation.h"
+#include "document_store.h"
+#include "stop_word_set.h"
+#include "impact_index.h"
+#include "index_types.h"
+#include "ingest_buffer.h"
+#include "position_index.h"
+#include "scoring_index.h"
+#include "scoring_kernel.h"
+#include <memory>
+#include <optional>
+#include <unordered_map>
 #include <thread>
 #include <future>
 #include <type_traits>
+#include <limits>
+#include <array>
+#include <cstdint>
 
 const int MAX_RESULT_DOCUMENT_COUNT = 5;
 const double DEAD_ZONE = 1e-6;
+//Сколько слов запроса помещается во встроенный буфер без обращения к куче
+const size_t QUERY_INLINE_WORD_COUNT = 20;
+//Сколько слов словаря может раскрыть одно плюс-слово с '*'; при превышении берутся самые частые.
+//Минус-слово с '*' исключает документы со всеми словами с этим началом
+const size_t MAX_PREFIX_EXPANSIONS = 1024;
+//Векторный подсчёт идёт, если буфер по id документа не больше стольких записей списков на одну запись
+const size_t SCORING_DENSE_RATIO = 8;
 
-enum class DocumentStatus {
-    ACTUAL,
-    IRRELEVANT,
-    BANNED,
-    REMOVED,
+//Настройки сервера, задаются при создании
+struct SearchServerOptions {
+    TextStorageMode text_storage = TextStorageMode::PLAIN;
+    //Дополнительно хранить длинные списки документов по убыванию частоты слова,
+    //чтобы поиск мог остановиться, не дочитав их. Больше памяти, меньше задержка
+    bool impact_ordered_postings = false;
+    //Мягкий лимит памяти в байтах (0 — без лимита). При превышении AddDocument
+    //сбрасывает кэши и уплотняет хранилища, см. SearchServer::CompactMemory.
+    //Повторно — только после заметного роста памяти
+    size_t memory_budget_bytes = 0;
+    //Хранить позиции слов в документах, нужны для фраз в кавычках ("white cat").
+    //Без них кавычка в запросе — обычный символ слова, как и в тексте документов.
+    //Запросы без фраз позиции не читают
+    bool positional_index = false;
+    //Считать релевантность во float векторными инструкциями по копиям списков в массивах.
+    //Результат тот же: документы, близкие к топу, пересчитываются точно
+    bool vectorized_scoring = false;
+};
+
+//Фильтр поиска, который сервер применяет по индексу, не проверяя каждую запись списков.
+//Границы диапазонов включаются
+struct DocumentFilter {
+    static constexpr unsigned StatusBit(DocumentStatus status) {
+        return 1u << static_cast<int>(status);
+    }
+
+    //Допустимые статусы, по биту на статус. По умолчанию только ACTUAL, как у FindTopDocuments без фильтра
+    unsigned statuses = StatusBit(DocumentStatus::ACTUAL);
+    int min_rating = std::numeric_limits<int>::min();
+    int max_rating = std::numeric_limits<int>::max();
+    int min_document_id = 0;
+    int max_document_id = std::numeric_limits<int>::max();
+
+    bool HasRatingRange() const {
+        return min_rating != std::numeric_limits<int>::min() || max_rating != std::numeric_limits<int>::max();
+    }
+
+    bool HasDocumentIdRange() const {
+        return min_document_id != 0 || max_document_id != std::numeric_limits<int>::max();
+    }
+
+    bool Matches(int document_id, DocumentStatus status, int rating) const {
+        return (statuses & StatusBit(status)) != 0 && min_rating <= rating && rating <= max_rating
+               && min_document_id <= document_id && document_id <= max_document_id;
+    }
+};
+
+//Предикат «все документы»: поиск не читает статус и рейтинг документа на каждую запись списка
+struct AnyDocument {
+    bool operator()(int, DocumentStatus, int) const {
+        return true;
+    }
+};
+
+//Вид предиката FindTopDocuments, определяется его типом при компиляции
+enum class PredicateKind {
+    ALWAYS_TRUE,  //AnyDocument: предикат не вызывается
+    STATUS,       //DocumentStatus: документы статуса из колонки рейтингов, если их меньше, чем записей в списках
+    ARBITRARY,    //Любой вызываемый объект (id, статус, рейтинг), вызывается для каждого документа
+};
+
+template <typename DocumentPredicate>
+constexpr PredicateKind GetPredicateKind() {
+    if constexpr (std::is_same_v<std::decay_t<DocumentPredicate>, AnyDocument>) {
+        return PredicateKind::ALWAYS_TRUE;
+    } else if constexpr (std::is_same_v<std::decay_t<DocumentPredicate>, DocumentStatus>) {
+        return PredicateKind::STATUS;
+    } else {
+        return PredicateKind::ARBITRARY;
+    }
+}
+
+//Порядок выдачи: по релевантности, при равной (с точностью DEAD_ZONE) по рейтингу
+struct RelevanceOrder {
+    static bool Before(const Document& lhs, const Document& rhs) {
+        if (std::abs(lhs.relevance - rhs.relevance) < DEAD_ZONE) {
+            return lhs.rating > rhs.rating;
+        } else {
+            return lhs.relevance > rhs.relevance;
+        }
+    }
+};
+
+//Релевантность в долях DEAD_ZONE (40 бит, до ~1.1e6) и рейтинг (24 бита) в одном ключе: сравнение
+//без ветвлений. В отличие от RelevanceOrder, равными считаются релевантности из одной доли DEAD_ZONE,
+//рейтинги за пределами ±2^23 упираются в границу
+struct PackedRelevanceOrder {
+    static uint64_t Key(const Document& document) {
+        const double quantized = std::min(std::max(document.relevance, 0.0) * (1.0 / DEAD_ZONE), static_cast<double>((uint64_t{1} << 40) - 1));
+        const int rating = std::clamp(document.rating, -(1 << 23), (1 << 23) - 1);
+        return (static_cast<uint64_t>(quantized) << 24) | static_cast<uint64_t>(rating + (1 << 23));
+    }
+
+    static bool Before(const Document& lhs, const Document& rhs) {
+        return Key(lhs) > Key(rhs);
+    }
+};
+
+//До такого K топ собирается вставкой в массив фиксированного размера, дальше — частичной сортировкой
+const size_t INLINE_TOP_COUNT = 16;
+
+struct MemoryUsage {
+    size_t bytes = 0;
+    size_t entries = 0;
+};
+
+//Память по внутренним структурам сервера
+struct MemoryStats {
+    MemoryUsage dictionary;      //Слова и узлы обратного индекса
+    MemoryUsage postings;        //Списки документов по словам
+    MemoryUsage forward_index;   //Слова по документам
+    MemoryUsage documents;       //Рейтинг, статус и положение текста документов
+    MemoryUsage document_store;  //Тексты документов
+    MemoryUsage caches;          //Списки по убыванию частоты и массивы для векторного подсчёта
+    MemoryUsage positions;       //Позиции слов (positional_index)
+
+    size_t GetTotalBytes() const {
+        return dictionary.bytes + postings.bytes + forward_index.bytes + documents.bytes + document_store.bytes + caches.bytes
+               + positions.bytes;
+    }
 };
 
 class SearchServer {
 public:
      using Iterator_map  = typename std::map<int, std::map<std::string, double>>::iterator;
-     using Iterator_id  = typename std::set<int>::iterator;
+     using Iterator_id  = typename CountedSet<int>::iterator;
 
     template <typename StringContainer>
-    explicit SearchServer(const StringContainer stop_words)
-        : stop_words_(MakeUniqueNonEmptyStrings(stop_words))  // Extract non-empty stop words
+    explicit SearchServer(const StringContainer stop_words, const SearchServerOptions& options = {})
+        : stop_words_(MakeStopWords(stop_words))
+        , document_store_(options.text_storage)
+        , impact_index_(options.impact_ordered_postings ? std::make_unique<ImpactIndex>() : nullptr)
+        , positions_(options.positional_index ? std::make_unique<PositionIndex>() : nullptr)
+        , scoring_index_(options.vectorized_scoring ? std::make_unique<ScoringIndex>() : nullptr)
+        , memory_budget_bytes_(options.memory_budget_bytes)
     {
-        if (!std::all_of(stop_words_.begin(), stop_words_.end(), IsValidWord)) {
-            throw std::invalid_argument("Some of stop words are invalid");
-        }
     }
 
-    explicit SearchServer(const std::string_view stop_words_text);
-    explicit SearchServer(const std::string& stop_words_text);
+    explicit SearchServer(const std::string_view stop_words_text, const SearchServerOptions& options = {});
+    explicit SearchServer(const std::string& stop_words_text, const SearchServerOptions& options = {});
+
+    //Копия строит свой словарь и индексы: ключи индексов ссылаются только на её собственные слова.
+    //Кэши перестраиваются при первом поиске, документы, не перенесённые PublishDocuments, не копируются
+    SearchServer(const SearchServer& other);
+    SearchServer(SearchServer&& other) = default;
 
     void AddDocument(int document_id, const std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
-    //Удаление документа
+    //Есть ли документ с таким id, в том числе ждущий PublishDocuments
+    bool HasDocument(int document_id) const;
+    //Бросает то же invalid_argument, что и AddDocument для недопустимого слова текста
+    static void CheckDocumentText(const std::string_view document);
+    //Добавление из многих потоков сразу. Документ попадает в поиск после PublishDocuments.
+    //Поиск может идти одновременно с этим добавлением, но не с PublishDocuments и не с другими изменениями
+    void AddDocument(std::execution::parallel_policy, int document_id, const std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+    //Переносит в индекс документы, добавленные параллельно; возвращает их число.
+    //Писатели на время переноса ждут, слова разных документов раскладываются параллельно
+    size_t PublishDocuments();
+    //Удаление документа. Документы, ещё не перенесённые PublishDocuments, не затрагиваются
     void RemoveDocument(int document_id);
     //Удаление документа с execution
 
@@ -54,46 +209,156 @@ public:
 
     void RemoveDocument(std::execution::parallel_policy, int document_id);
 
-    template <typename DocumentPredicate>
-    std::vector<Document> FindTopDocuments(std::execution::sequenced_policy, const std::string_view raw_query, DocumentPredicate document_predicate) const {
-        std::string query_words = std::string(raw_query);
+    //Удаление пачки документов, отсутствующие id пропускаются. Записи индекса группируются по словам,
+    //каждое слово чистит один поток без блокировок; слова, оставшиеся без документов, удаляются из словаря
+    void RemoveDocuments(const std::vector<int>& document_ids);
+    void RemoveDocuments(std::execution::sequenced_policy, const std::vector<int>& document_ids);
+    void RemoveDocuments(std::execution::parallel_policy, const std::vector<int>& document_ids);
 
-        const auto query = ParseQuery(query_words);
-        auto matched_documents = FindAllDocuments(std::execution::seq, query, document_predicate);
+    //Слово запроса, связанное с записью индекса (postings == nullptr, если слова нет в индексе).
+    //IDF считается при разборе и может быть заменён снаружи, например глобальным значением по шардам.
+    //У префикса ("word*") postings — объединение списков всех слов словаря с этим началом,
+    //у фразы ("white cat") — документы, где слова идут подряд, с частотой фразы в документе
+    struct QueryTerm {
+        std::string_view word;
+        const DocumentFreqs* postings;
+        double inverse_document_freq;
+        bool is_prefix = false;
+        bool is_phrase = false;
+    };
 
-        sort(matched_documents.begin(), matched_documents.end(), [](const Document& lhs, const Document& rhs) {
-            if (std::abs(lhs.relevance - rhs.relevance) < DEAD_ZONE) {
-                return lhs.rating > rhs.rating;
-            } else {
-                return lhs.relevance > rhs.relevance;
-            }
-        });
-        if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-            matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+    //Список документов префикса или фразы, построенный при разборе запроса
+    struct ExpandedTerm {
+        std::string text;
+        DocumentFreqs postings;
+        //Сколько слов словаря вошло в список
+        size_t word_count = 0;
+        //Слова словаря из списка по возрастанию: у фразы — её слова без стоп-слов,
+        //у префикса — слова, оставшиеся после ограничения MAX_PREFIX_EXPANSIONS
+        std::vector<std::string_view> words;
+    };
+
+    //Разобранный запрос: слова отсортированы и без повторов.
+    //Можно переиспользовать между вызовами ParseQuery, пока индекс не меняется
+    struct Query {
+        SmallVector<QueryTerm, QUERY_INLINE_WORD_COUNT> plus_words;
+        SmallVector<QueryTerm, QUERY_INLINE_WORD_COUNT> minus_words;
+        //Владеет списками префиксов и фраз, на которые ссылаются слова
+        std::vector<std::shared_ptr<const ExpandedTerm>> expansions;
+
+        bool HasExpandedTerms() const {
+            return !expansions.empty();
         }
+    };
 
-        return matched_documents;
+    Query ParseQuery(const std::string_view text) const;
+    void ParseQuery(const std::string_view text, Query& query) const;
+
+    //Слова словаря с этим началом и число их документов, по возрастанию слова
+    std::vector<std::pair<std::string_view, size_t>> GetPrefixWordCounts(const std::string_view prefix) const;
+    //Список плюс-префикса prefix в запросе строится заново только из слов words (по возрастанию),
+    //которых нет в словаре — пропускаются. Так шарды берут одни и те же слова сверх MAX_PREFIX_EXPANSIONS
+    void RestrictPrefix(Query& query, const std::string_view prefix, const std::vector<std::string_view>& words) const;
+    //Оставляет max_words самых частых слов, при равной частоте — меньшие, и упорядочивает их по возрастанию
+    template <typename Count>
+    static void SelectPrefixWords(std::vector<std::pair<std::string_view, Count>>& words, size_t max_words) {
+        if (words.size() <= max_words) {
+            return;
+        }
+        std::nth_element(words.begin(), words.begin() + max_words, words.end(), [](const auto& lhs, const auto& rhs) {
+            return std::tie(rhs.second, lhs.first) < std::tie(lhs.second, rhs.first);
+        });
+        words.resize(max_words);
+        std::sort(words.begin(), words.end());
     }
 
-    template <typename DocumentPredicate>
-    std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentPredicate document_predicate) const {
-        //std::string query_words = std::string(raw_query);
-        //const auto query = ParseQuery(raw_query);
+    //IDF слова по числу документов всего и числу документов со словом
+    static double ComputeWordInverseDocumentFreq(int document_count, size_t word_document_count);
 
-        auto matched_documents = FindAllDocuments(std::execution::par, ParseQuery(raw_query), document_predicate);
+    //Порядок выдачи: по релевантности, при равной (с точностью DEAD_ZONE) по рейтингу
+    static bool IsMoreRelevant(const Document& lhs, const Document& rhs) {
+        return RelevanceOrder::Before(lhs, rhs);
+    }
 
-        sort(matched_documents.begin(), matched_documents.end(), [](const Document& lhs, const Document& rhs) {
-            if (std::abs(lhs.relevance - rhs.relevance) < DEAD_ZONE) {
-                return lhs.rating > rhs.rating;
-            } else {
-                return lhs.relevance > rhs.relevance;
+    //Первые K документов в порядке Order, без сортировки остальных. Равные по Order документы
+    //упорядочены по id, так что результат не зависит от порядка кандидатов. При K до INLINE_TOP_COUNT
+    //топ держится в массиве на стеке и пополняется вставкой
+    template <size_t K, typename Order>
+    static void SelectTopDocuments(std::vector<Document>& documents) {
+        const auto before = [](const Document& lhs, const Document& rhs) {
+            if (Order::Before(lhs, rhs)) {
+                return true;
             }
-        });
-        if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-            matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+            return !Order::Before(rhs, lhs) && lhs.id < rhs.id;
+        };
+        if constexpr (K <= INLINE_TOP_COUNT) {
+            std::array<Document, K> top;
+            size_t count = 0;
+            for (const Document& document : documents) {
+                if (count == K && !before(document, top[K - 1])) {
+                    continue;
+                }
+                size_t position = count < K ? count++ : K - 1;
+                while (position > 0 && before(document, top[position - 1])) {
+                    top[position] = top[position - 1];
+                    --position;
+                }
+                top[position] = document;
+            }
+            documents.assign(top.begin(), top.begin() + count);
+        } else {
+            const size_t count = std::min(documents.size(), K);
+            std::partial_sort(documents.begin(), documents.begin() + count, documents.end(), before);
+            documents.resize(count);
         }
+    }
 
-        return matched_documents;
+    //Поиск, специализированный при компиляции: K результатов в порядке Order (RelevanceOrder или
+    //PackedRelevanceOrder), путь отбора по виду предиката (см. PredicateKind).
+    //При отмене token бросает QueryCancelled
+    template <size_t K, typename Order = RelevanceOrder, typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy policy, const Query& query, DocumentPredicate document_predicate,
+                                           const CancellationToken* token = nullptr) const {
+        static_assert(K > 0, "FindTopDocuments needs K > 0");
+        if constexpr (GetPredicateKind<DocumentPredicate>() == PredicateKind::STATUS) {
+            DocumentFilter filter;
+            filter.statuses = DocumentFilter::StatusBit(document_predicate);
+            std::vector<Document> matched_documents;
+            if (FindFilteredDocuments(query, filter, matched_documents, token)) {
+                SelectTopDocuments<K, Order>(matched_documents);
+                return matched_documents;
+            }
+            return FindTopDocuments<K, Order>(policy, query, [status = document_predicate](int, DocumentStatus document_status, int) {
+                return document_status == status;
+            }, token);
+        } else {
+            if (impact_index_ != nullptr) {
+                return FindTopDocumentsByImpact<K, Order>(query, document_predicate, token);
+            }
+            return FindTopDocumentsByPlan<K, Order>(policy, query, document_predicate, token);
+        }
+    }
+
+    template <size_t K, typename Order = RelevanceOrder, typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy policy, const std::string_view raw_query, DocumentPredicate document_predicate) const {
+        return FindTopDocuments<K, Order>(policy, ParseQuery(raw_query), document_predicate);
+    }
+
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(std::execution::sequenced_policy, const std::string_view raw_query, DocumentPredicate document_predicate) const {
+        return FindTopDocuments<MAX_RESULT_DOCUMENT_COUNT>(std::execution::seq, ParseQuery(raw_query), document_predicate);
+    }
+
+    //Поиск по уже разобранному запросу; при отмене token бросает QueryCancelled
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(std::execution::sequenced_policy, const Query& query, DocumentPredicate document_predicate,
+                                           const CancellationToken* token = nullptr) const {
+        return FindTopDocuments<MAX_RESULT_DOCUMENT_COUNT>(std::execution::seq, query, document_predicate, token);
+    }
+
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentPredicate document_predicate) const {
+        return FindTopDocuments<MAX_RESULT_DOCUMENT_COUNT>(std::execution::par, ParseQuery(raw_query), document_predicate);
     }
 
     std::vector<Document> FindTopDocuments(std::execution::sequenced_policy, const std::string_view raw_query) const;
@@ -105,43 +370,189 @@ public:
     std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentStatus status) const;
     std::vector<Document> FindTopDocuments(const std::string_view raw_query) const;
 
+    //Поиск со структурным фильтром. Если по колонке рейтингов или диапазону id подходящих документов
+    //меньше, чем записей в списках слов запроса, обходятся только они; иначе фильтр проверяется как предикат
+    std::vector<Document> FindTopDocuments(std::execution::sequenced_policy, const std::string_view raw_query, const DocumentFilter& filter) const;
+    std::vector<Document> FindTopDocuments(std::execution::parallel_policy, const std::string_view raw_query, const DocumentFilter& filter) const;
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query, const DocumentFilter& filter) const;
+
+
+    enum class QueryStrategy {
+        TERM_AT_A_TIME,      //Слово за словом, релевантность копится в мапе
+        DOCUMENT_AT_A_TIME,  //Слияние списков по id документа, без промежуточной мапы
+    };
+
+    struct QueryPlanStep {
+        std::string_view word;
+        size_t document_count;
+        double inverse_document_freq;
+        bool is_minus;
+        //Слово не обходится: его нет в индексе или его IDF нулевой
+        bool is_dropped;
+        bool is_prefix;
+        bool is_phrase;
+    };
+
+    //План выполнения запроса. Строится по числу документов у каждого слова
+    struct QueryPlan {
+        //В порядке выполнения: сначала минус-слова, потом плюс-слова в порядке запроса,
+        //в котором складывается релевантность. Плюс-слова не переставляются от дешёвых к дорогим:
+        //документ подходит по любому слову, так что каждый список читается целиком при любом порядке,
+        //а другой порядок сложения изменил бы релевантность в последних битах и разошёлся бы
+        //с векторным ядром и обходом по документам
+        SmallVector<QueryPlanStep, 2 * QUERY_INLINE_WORD_COUNT> steps;
+        QueryStrategy strategy = QueryStrategy::TERM_AT_A_TIME;
+        //Отброшено плюс-слово из всех документов: вклада оно не даёт,
+        //но любой документ остаётся кандидатом с нулевой релевантностью
+        bool matches_all_documents = false;
+        //Оценки стоимости в просмотренных записях индекса
+        double term_at_a_time_cost = 0.0;
+        double document_at_a_time_cost = 0.0;
+        //Слова префиксов и фраз в steps ссылаются сюда (заполняется в ExplainQuery)
+        std::vector<std::shared_ptr<const ExpandedTerm>> expansions;
+    };
+
+    QueryPlan PlanQuery(const Query& query) const;
+    //Для отладки: план, по которому будет выполнен запрос
+    QueryPlan ExplainQuery(const std::string_view raw_query) const;
+    //Для отладки и сравнения планов: стратегия для всех запросов вместо выбранной по стоимости
+    //(std::nullopt — снова по стоимости). Не вызывается одновременно с поиском
+    void ForceQueryStrategy(std::optional<QueryStrategy> strategy);
 
     int GetDocumentCount() const;
 
     int GetDocumentId(int index) const;
 
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::string_view raw_query, int document_id) const;
+    //Проверка по уже разобранному запросу; при отмене token бросает QueryCancelled
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const Query& query, int document_id,
+                                                                            const CancellationToken* token = nullptr) const;
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::execution::sequenced_policy, const std::string_view raw_query, int document_id) const;
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::execution::parallel_policy,const std::string_view raw_query, int document_id) const;
 
+    //Совпадения запроса с пачкой документов.
+    //Слова документа documents[i] лежат в words[words_begin, words_begin + words_count)
+    struct MatchedDocument {
+        int document_id;
+        DocumentStatus status;
+        size_t words_begin;
+        size_t words_count;
+    };
+
+    struct MatchedDocuments {
+        std::vector<MatchedDocument> documents;
+        std::vector<std::string_view> words;
+    };
+
+    MatchedDocuments MatchDocuments(const std::string_view raw_query, const std::vector<int>& document_ids) const;
+    MatchedDocuments MatchDocuments(std::execution::parallel_policy, const std::string_view raw_query, const std::vector<int>& document_ids) const;
+    //Заполнение уже существующего результата, чтобы не выделять память заново
+    void MatchDocuments(std::execution::sequenced_policy, const std::string_view raw_query, const std::vector<int>& document_ids, MatchedDocuments& result) const;
+    void MatchDocuments(std::execution::parallel_policy, const std::string_view raw_query, const std::vector<int>& document_ids, MatchedDocuments& result) const;
+
     Iterator_id begin();
     Iterator_id end();
 
     const std::map<std::string_view, double> GetWordFrequencies(int document_id) const;
 
+    //Текст документа из хранилища; в режиме TextStorageMode::NONE бросает std::logic_error
+    std::string GetDocumentText(int document_id) const;
+    //Обход текстов всех документов в порядке хранения, каждый сжатый блок распаковывается один раз.
+    //text действителен только внутри вызова function
+    void ForEachDocumentText(const std::function<void(int document_id, std::string_view text)>& function) const;
+    DocumentStatus GetDocumentStatus(int document_id) const;
+    //Средний рейтинг, посчитанный при добавлении
+    int GetDocumentRating(int document_id) const;
+
+    MemoryStats GetMemoryStats() const;
+    //Сброс кэшей (перестраиваются при следующем поиске), удаление слов без документов и переупаковка текстов
+    void CompactMemory();
+
 private:
     struct DocumentData {
         int rating;
         DocumentStatus status;
-        std::string data;
+        DocumentStore::Location text;
+    };
+
+    //Счётчики памяти по структурам. Лежат в куче, чтобы аллокаторы контейнеров
+    //не теряли их при перемещении сервера
+    struct MemoryCounters {
+        MemoryCounter dictionary;
+        MemoryCounter postings;
+        MemoryCounter forward_index;
+        MemoryCounter documents;
     };
+    std::unique_ptr<MemoryCounters> memory_counters_ = std::make_unique<MemoryCounters>();
+
+    const StopWordSet stop_words_;
+
+    //Единственная копия каждого слова индекса, ключи обоих индексов ссылаются сюда
+    CountedSet<std::string, std::less<>> words_{MakeCountingAllocator<CountedSet<std::string, std::less<>>>(&memory_counters_->dictionary)};
+    DocumentStore document_store_;
+    //Есть только при SearchServerOptions::impact_ordered_postings
+    std::unique_ptr<ImpactIndex> impact_index_;
+    //Есть только при SearchServerOptions::positional_index
+    std::unique_ptr<PositionIndex> positions_;
+    //Есть только при SearchServerOptions::vectorized_scoring
+    std::unique_ptr<ScoringIndex> scoring_index_;
 
-    const std::set<std::string, std::less<>> stop_words_;
+    //Документы, добавленные параллельно и ещё не опубликованные
+    std::unique_ptr<IngestBuffer> ingest_buffer_ = std::make_unique<IngestBuffer>();
 
-    std::map<std::string_view, std::map<int, double>> word_to_document_freqs_;
+    size_t memory_budget_bytes_ = 0;
+    std::optional<QueryStrategy> forced_strategy_;
+    //Следующее уплотнение не раньше, чем память дорастёт до этого значения
+    size_t next_compaction_bytes_ = 0;
+    //Между уплотнениями память должна вырасти на 1/4 от текущей
+    static constexpr size_t COMPACTION_GROWTH_DIVISOR = 4;
+    //Уплотнение, освободившее меньше 1/16 памяти, считается бесполезным
+    static constexpr size_t MIN_COMPACTION_GAIN_DIVISOR = 16;
+
+    WordToDocumentFreqs word_to_document_freqs_{MakeCountingAllocator<WordToDocumentFreqs>(&memory_counters_->dictionary, &memory_counters_->postings)};
     //Для быстрого возврата слов в документе по айди
-    std::map<int, std::map<std::string_view, double>> id_words_freg_;
+    DocumentToWordFreqs id_words_freg_{MakeCountingAllocator<DocumentToWordFreqs>(&memory_counters_->forward_index, &memory_counters_->forward_index)};
     //Для пустого возврата слов
     std::map<std::string_view, double> zero_res_;
 
-    std::set<int> set_id_;
+    CountedSet<int> set_id_{MakeCountingAllocator<CountedSet<int>>(&memory_counters_->documents)};
+
+    CountedMap<int, DocumentData> documents_{MakeCountingAllocator<CountedMap<int, DocumentData>>(&memory_counters_->documents)};
 
-    std::map<int, DocumentData> documents_;
+    //Колонка рейтингов: документы упорядочены по статусу, рейтингу и id,
+    //диапазон рейтингов одного статуса — непрерывный отрезок
+    using RatingKey = std::tuple<DocumentStatus, int, int>;
+    CountedSet<RatingKey> ratings_{MakeCountingAllocator<CountedSet<RatingKey>>(&memory_counters_->documents)};
+    //Число документов по статусам, для выбора отбора по колонке рейтингов
+    std::array<size_t, 4> status_counts_{};
 
 
     //std::vector<int> document_ids_;
 
-    bool IsStopWord(const std::string_view word) const;
+    template <typename StringContainer>
+    static StopWordSet MakeStopWords(const StringContainer& stop_words) {
+        const auto unique_words = MakeUniqueNonEmptyStrings(stop_words);  // Extract non-empty stop words
+        if (!std::all_of(unique_words.begin(), unique_words.end(), IsValidWord)) {
+            throw std::invalid_argument("Some of stop words are invalid");
+        }
+        return StopWordSet(unique_words);
+    }
+
+    template <size_t N>
+    static StopWordSet MakeStopWords(const StaticStopWordSet<N>& stop_words) {
+        if (!std::all_of(stop_words.begin(), stop_words.end(), [](const std::string_view word) {
+                return word.empty() || IsValidWord(word);
+            })) {
+            throw std::invalid_argument("Some of stop words are invalid");
+        }
+        return StopWordSet(stop_words);
+    }
+
+    bool IsStopWord(const std::string_view word) const {
+        return stop_words_.Contains(word);
+    }
+
+    std::string_view InternWord(const std::string_view word);
 
     static bool IsValidWord(const std::string_view word);
 
@@ -155,51 +566,505 @@ private:
         std::string_view data;
         bool is_minus;
         bool is_stop;
+        bool is_prefix;
     };
 
     QueryWord ParseQueryWord(const std::string_view text) const;
 
-    struct Query {
-        std::set<std::string_view> plus_words;
-        std::set<std::string_view> minus_words;
-    };
+    bool HasMinusWord(const Query& query, int document_id) const;
+    //Документы хотя бы с одним минус-словом, по возрастанию id
+    std::vector<int> CollectMinusDocuments(const Query& query) const;
 
-    struct VecQuery {
-        std::vector<std::string_view> plus_words;
-        std::vector<std::string_view> minus_words;
-    };
+    //Для обхода списка по возрастанию id: next продвигается по excluded вместе со списком
+    static bool IsExcluded(const std::vector<int>& excluded, std::vector<int>::const_iterator& next, int document_id) {
+        while (next != excluded.end() && *next < document_id) {
+            ++next;
+        }
+        return next != excluded.end() && *next == document_id;
+    }
 
-    std::string query_words_;
+    //Список слова изменился: кэши по нему устарели
+    void MarkWordChanged(const std::string_view word);
+    //Слово удаляется из словаря вместе с кэшами по нему
+    void EraseWordCaches(const std::string_view word);
+
+    //Быстрая оценка занятой памяти без обхода структур
+    size_t GetTrackedBytes() const;
+    void EnforceMemoryBudget();
+
+    //Сортировка, удаление повторов и поиск слов в индексе
+    void ResolveQueryWords(SmallVector<QueryTerm, QUERY_INLINE_WORD_COUNT>& words, std::vector<std::shared_ptr<const ExpandedTerm>>& expansions,
+                           bool is_minus) const;
+    //Слова словаря с этим началом (не больше max_words самых частых) и слияние их списков через кучу
+    std::shared_ptr<const ExpandedTerm> ExpandPrefix(const std::string_view prefix, size_t max_words) const;
+    //Слияние списков слов по возрастанию слова в одно раскрытие префикса
+    std::shared_ptr<const ExpandedTerm> MergePrefixLists(const std::string_view prefix,
+                                                         const std::vector<std::pair<std::string_view, const DocumentFreqs*>>& lists) const;
+    //Документы, где слова фразы стоят подряд: пересечение списков, затем сверка позиций
+    std::shared_ptr<const ExpandedTerm> ExpandPhrase(const std::string_view phrase) const;
+    //Позиции слов документа в формате PositionIndex, по возрастанию слова
+    std::string BuildPositionStream(const std::string_view document) const;
+    //Сколько слов могут дать совпадения плюс-слов запроса с документом из document_word_count слов
+    size_t GetMatchCapacity(const Query& query, size_t document_word_count) const;
+    //Раскрытие, на список которого ссылается слово префикса или фразы
+    static const ExpandedTerm& FindExpansion(const Query& query, const QueryTerm& term);
 
-    Query ParseQuery(const std::string_view text) const;
-    VecQuery ParseQueryVec(const std::string_view text) const;
 
-    // Existence required
-    double ComputeWordInverseDocumentFreq(const std::string_view word) const;
+    //Обход длинных списков по корзинам в порядке убывания вклада. Поиск останавливается,
+    //когда даже весь недочитанный вклад не поднимет документ вне топа до K-го места.
+    //Для оставшихся кандидатов релевантность пересчитывается точно, в том же порядке слов,
+    //что и в FindAllDocuments, поэтому результат не отличается от полного обхода
+    template <size_t K, typename Order, typename DocumentPredicate>
+    std::vector<Document> FindTopDocumentsByImpact(const Query& query, DocumentPredicate document_predicate, const CancellationToken* token) const {
+        //Слово с нулевым IDF совпадает со всеми документами, но по корзинам не обходится:
+        //документы только с такими словами достраивает план
+        if (std::any_of(query.plus_words.begin(), query.plus_words.end(), [this](const QueryTerm& term) {
+                return IsZeroContributionTerm(term);
+            })) {
+            return FindTopDocumentsByPlan<K, Order>(std::execution::seq, query, document_predicate, token);
+        }
+        impact_index_->Refresh(word_to_document_freqs_);
+
+        struct Accumulator {
+            double partial = 0.0;
+            bool rejected = false;
+        };
+        std::unordered_map<int, Accumulator> accumulators;
+        auto add_score = [&](int document_id, double score) {
+            auto [it, inserted] = accumulators.try_emplace(document_id);
+            if (inserted) {
+                it->second.rejected = !IsAccepted(document_predicate, document_id) || HasMinusWord(query, document_id);
+            }
+            it->second.partial += score;
+        };
 
+        struct Cursor {
+            const ImpactIndex::List* list;
+            double inverse_document_freq;
+            size_t bucket;
+
+            //Верхняя граница вклада ещё не прочитанных документов
+            double GetBound() const {
+                if (bucket == list->bucket_ends.size()) {
+                    return 0.0;
+                }
+                const size_t begin = bucket == 0 ? 0 : list->bucket_ends[bucket - 1];
+                return list->postings[begin].second * inverse_document_freq;
+            }
+        };
+        SmallVector<Cursor, QUERY_INLINE_WORD_COUNT> cursors;
+
+        for (const QueryTerm& term : query.plus_words) {
+            if (term.postings == nullptr) {
+                continue;
+            }
+            const ImpactIndex::List* list = term.is_prefix || term.is_phrase ? nullptr : impact_index_->Find(term.word);
+            if (list != nullptr) {
+                cursors.push_back({list, term.inverse_document_freq, 0});
+                continue;
+            }
+            for (const auto [document_id, term_freq] : *term.postings) {
+                add_score(document_id, term_freq * term.inverse_document_freq);
+            }
+        }
+
+        std::vector<double> partials;
+        double remaining = 0.0;
+        double kth = 0.0;
+        bool has_kth = false;
+        while (true) {
+            if (token != nullptr && token->IsCancelled()) {
+                throw QueryCancelled();
+            }
+
+            remaining = 0.0;
+            Cursor* best = nullptr;
+            for (Cursor& cursor : cursors) {
+                const double bound = cursor.GetBound();
+                remaining += bound;
+                if (bound > 0.0 && (best == nullptr || bound > best->GetBound())) {
+                    best = &cursor;
+                }
+            }
+            if (best == nullptr) {
+                remaining = 0.0;
+                break;
+            }
+
+            partials.clear();
+            for (const auto& [_, accumulator] : accumulators) {
+                if (!accumulator.rejected) {
+                    partials.push_back(accumulator.partial);
+                }
+            }
+            if (partials.size() >= K) {
+                std::nth_element(partials.begin(), partials.begin() + (K - 1), partials.end(), std::greater<>());
+                kth = partials[K - 1];
+                has_kth = true;
+                if (remaining < kth - DEAD_ZONE) {
+                    break;
+                }
+            }
+
+            const size_t begin = best->bucket == 0 ? 0 : best->list->bucket_ends[best->bucket - 1];
+            const size_t end = best->list->bucket_ends[best->bucket];
+            for (size_t i = begin; i < end; ++i) {
+                const auto [document_id, term_freq] = best->list->postings[i];
+                add_score(document_id, term_freq * best->inverse_document_freq);
+            }
+            ++best->bucket;
+        }
+
+        std::vector<Document> matched_documents;
+        for (const auto& [document_id, accumulator] : accumulators) {
+            if (accumulator.rejected || (has_kth && accumulator.partial + remaining < kth - DEAD_ZONE)) {
+                continue;
+            }
+            double relevance = 0.0;
+            for (const QueryTerm& term : query.plus_words) {
+                if (term.postings == nullptr) {
+                    continue;
+                }
+                const auto posting = term.postings->find(document_id);
+                if (posting != term.postings->end()) {
+                    relevance += posting->second * term.inverse_document_freq;
+                }
+            }
+            matched_documents.push_back({document_id, relevance, documents_.at(document_id).rating});
+        }
+
+        SelectTopDocuments<K, Order>(matched_documents);
+        return matched_documents;
+    }
+
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocumentsWithFilter(ExecutionPolicy policy, const std::string_view raw_query, const DocumentFilter& filter) const {
+        const auto query = ParseQuery(raw_query);
+        std::vector<Document> matched_documents;
+        if (FindFilteredDocuments(query, filter, matched_documents)) {
+            SelectTopDocuments<MAX_RESULT_DOCUMENT_COUNT, RelevanceOrder>(matched_documents);
+            return matched_documents;
+        }
+
+        const auto predicate = [&filter](int document_id, DocumentStatus status, int rating) {
+            return filter.Matches(document_id, status, rating);
+        };
+        return FindTopDocuments<MAX_RESULT_DOCUMENT_COUNT>(policy, query, predicate);
+    }
+
+    //Проверка документа предикатом; для AnyDocument ни документ, ни предикат не читаются
     template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(std::execution::sequenced_policy, const Query& query, DocumentPredicate document_predicate) const {
-        std::map<int, double> document_to_relevance;
-        for (const std::string_view word : query.plus_words) {
-            //std::cout << "Word" <<word << std::endl;
-            if (word_to_document_freqs_.count(word) == 0) {
+    static bool IsAccepted(DocumentPredicate& document_predicate, int document_id, const DocumentData& document_data) {
+        if constexpr (GetPredicateKind<DocumentPredicate>() == PredicateKind::ALWAYS_TRUE) {
+            return true;
+        } else {
+            return document_predicate(document_id, document_data.status, document_data.rating);
+        }
+    }
+
+    template <typename DocumentPredicate>
+    bool IsAccepted(DocumentPredicate& document_predicate, int document_id) const {
+        if constexpr (GetPredicateKind<DocumentPredicate>() == PredicateKind::ALWAYS_TRUE) {
+            return true;
+        } else {
+            return IsAccepted(document_predicate, document_id, documents_.at(document_id));
+        }
+    }
+
+    //Подсчёт релевантности только для документов, отобранных фильтром по индексу.
+    //false, если отбор не дешевле обычного обхода списков. При отмене token бросает QueryCancelled
+    bool FindFilteredDocuments(const Query& query, const DocumentFilter& filter, std::vector<Document>& matched_documents,
+                               const CancellationToken* token = nullptr) const;
+
+    //Выполнение запроса по плану: слова с нулевым IDF не обходятся, стратегия выбирается по оценке стоимости.
+    //Результат совпадает с полным обходом всех слов
+    template <size_t K, typename Order, typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocumentsByPlan(ExecutionPolicy policy, const Query& query, DocumentPredicate document_predicate,
+                                                 const CancellationToken* token) const {
+        const QueryPlan plan = PlanQuery(query);
+
+        const Query* effective_query = &query;
+        Query pruned_query;
+        if (plan.matches_all_documents) {
+            for (const QueryTerm& term : query.plus_words) {
+                if (!IsZeroContributionTerm(term)) {
+                    pruned_query.plus_words.push_back(term);
+                }
+            }
+            for (const QueryTerm& term : query.minus_words) {
+                pruned_query.minus_words.push_back(term);
+            }
+            effective_query = &pruned_query;
+        }
+
+        std::vector<Document> matched_documents;
+        if (scoring_index_ == nullptr || !FindDocumentsByKernel(*effective_query, document_predicate, K, token, matched_documents)) {
+            if (plan.strategy == QueryStrategy::DOCUMENT_AT_A_TIME) {
+                matched_documents = FindAllDocumentsByDocument(*effective_query, document_predicate, token);
+            } else {
+                matched_documents = FindAllDocuments(policy, *effective_query, document_predicate, token);
+            }
+        }
+        if (plan.matches_all_documents) {
+            AddZeroRelevanceDocuments(*effective_query, document_predicate, K, matched_documents);
+        }
+
+        SelectTopDocuments<K, Order>(matched_documents);
+        return matched_documents;
+    }
+
+    //Релевантность во float копится в буфере по id документа векторным ядром, без мапы и без предиката
+    //на каждую запись. Кандидаты, которые с учётом погрешности float могут попасть в топ, пересчитываются
+    //точно, в том же порядке слов, что и в FindAllDocuments. Результат упорядочен по id.
+    //false, если буфер слишком велик для этого запроса или есть слово с нулевым IDF
+    template <typename DocumentPredicate>
+    bool FindDocumentsByKernel(const Query& query, DocumentPredicate& document_predicate, size_t top_count, const CancellationToken* token,
+                               std::vector<Document>& matched_documents) const {
+        size_t plus_postings = 0;
+        size_t plus_lists = 0;
+        for (const QueryTerm& term : query.plus_words) {
+            if (term.postings == nullptr) {
                 continue;
             }
-            const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-            for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-                const auto& document_data = documents_.at(document_id);
-                if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                    document_to_relevance[document_id] += term_freq * inverse_document_freq;
+            //Документ только с такими словами — результат с нулевой релевантностью, в буфере его не отличить
+            if (!(term.inverse_document_freq > 0.0)) {
+                return false;
+            }
+            plus_postings += term.postings->size();
+            ++plus_lists;
+        }
+        if (plus_postings == 0) {
+            return false;
+        }
+        const size_t dense_size = static_cast<size_t>(documents_.rbegin()->first) + 1;
+        if (dense_size > SCORING_DENSE_RATIO * plus_postings) {
+            return false;
+        }
+        scoring_index_->Refresh(word_to_document_freqs_);
+
+        //Короткие списки, списки префиксов и фраз переводятся в массивы на время запроса
+        ScoringIndex::List converted;
+        const auto get_list = [this, &converted](const QueryTerm& term) -> const ScoringIndex::List& {
+            const ScoringIndex::List* list = term.is_prefix || term.is_phrase ? nullptr : scoring_index_->Find(term.word);
+            if (list == nullptr) {
+                converted = ScoringIndex::BuildList(*term.postings);
+                list = &converted;
+            }
+            return *list;
+        };
+
+        //Минус-слова первыми: -inf не меняется от сложения
+        std::vector<float> scores(dense_size, 0.0f);
+        for (const QueryTerm& term : query.minus_words) {
+            if (term.postings != nullptr) {
+                for (const int32_t document_id : get_list(term).document_ids) {
+                    scores[document_id] = -std::numeric_limits<float>::infinity();
+                }
+            }
+        }
+        for (const QueryTerm& term : query.plus_words) {
+            if (term.postings == nullptr) {
+                continue;
+            }
+            const ScoringIndex::List& list = get_list(term);
+            const float inverse_document_freq = static_cast<float>(term.inverse_document_freq);
+            for (size_t begin = 0; begin < list.document_ids.size(); begin += CANCELLATION_CHECK_INTERVAL) {
+                if (token != nullptr && token->IsCancelled()) {
+                    throw QueryCancelled();
+                }
+                const size_t count = std::min<size_t>(CANCELLATION_CHECK_INTERVAL, list.document_ids.size() - begin);
+                AccumulateScores(list.document_ids.data() + begin, list.term_freqs.data() + begin, count, inverse_document_freq, scores.data());
+            }
+        }
+
+        std::vector<std::pair<float, int>> candidates;
+        float max_score = 0.0f;
+        for (size_t document_id = 0; document_id < dense_size; ++document_id) {
+            if (scores[document_id] > 0.0f) {
+                candidates.push_back({scores[document_id], static_cast<int>(document_id)});
+                max_score = std::max(max_score, scores[document_id]);
+            }
+        }
+        //Слагаемые положительны, поэтому ошибка float не больше относительной на каждое округление
+        const float error = max_score * static_cast<float>(plus_lists + 4) * std::numeric_limits<float>::epsilon();
+        const float margin = 2 * error + static_cast<float>(DEAD_ZONE);
+
+        //Упорядочивается голова кандидатов; если в ней мало принятых предикатом, она растёт вдвое
+        const auto greater = [](const std::pair<float, int>& lhs, const std::pair<float, int>& rhs) {
+            return lhs.first > rhs.first;
+        };
+        size_t sorted = std::min(candidates.size(), 4 * top_count);
+        std::partial_sort(candidates.begin(), candidates.begin() + sorted, candidates.end(), greater);
+
+        size_t accepted = 0;
+        float kth_score = 0.0f;
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            if (i == sorted) {
+                const size_t next = std::min(candidates.size(), 2 * sorted);
+                std::partial_sort(candidates.begin() + sorted, candidates.begin() + next, candidates.end(), greater);
+                sorted = next;
+            }
+            const auto [score, document_id] = candidates[i];
+            if (accepted >= top_count && score < kth_score - margin) {
+                break;
+            }
+            if (!IsAccepted(document_predicate, document_id)) {
+                continue;
+            }
+            if (++accepted == top_count) {
+                kth_score = score;
+            }
+
+            double relevance = 0.0;
+            for (const QueryTerm& term : query.plus_words) {
+                if (term.postings == nullptr) {
+                    continue;
+                }
+                const auto posting = term.postings->find(document_id);
+                if (posting != term.postings->end()) {
+                    relevance += posting->second * term.inverse_document_freq;
+                }
+            }
+            matched_documents.push_back({document_id, relevance, documents_.at(document_id).rating});
+        }
+
+        std::sort(matched_documents.begin(), matched_documents.end(), [](const Document& lhs, const Document& rhs) {
+            return lhs.id < rhs.id;
+        });
+        return true;
+    }
+
+    //Слово есть во всех документах, его вклад в релевантность нулевой
+    bool IsZeroContributionTerm(const QueryTerm& term) const;
+
+    //Дополняет кандидатов документами с нулевой релевантностью, если они могут попасть в топ из top_count.
+    //matched_documents упорядочены по id и остаются упорядоченными
+    template <typename DocumentPredicate>
+    void AddZeroRelevanceDocuments(const Query& query, DocumentPredicate& document_predicate, size_t top_count,
+                                   std::vector<Document>& matched_documents) const {
+        //Документ с релевантностью не меньше DEAD_ZONE всегда выше документа с нулевой
+        const auto certain = std::count_if(matched_documents.begin(), matched_documents.end(), [](const Document& document) {
+            return document.relevance >= DEAD_ZONE;
+        });
+        if (static_cast<size_t>(certain) >= top_count) {
+            return;
+        }
+
+        std::vector<Document> all_documents;
+        all_documents.reserve(documents_.size());
+        auto matched = matched_documents.begin();
+        for (const auto& [document_id, document_data] : documents_) {
+            if (matched != matched_documents.end() && matched->id == document_id) {
+                all_documents.push_back(*matched++);
+            } else if (IsAccepted(document_predicate, document_id, document_data) && !HasMinusWord(query, document_id)) {
+                all_documents.push_back({document_id, 0.0, document_data.rating});
+            }
+        }
+        matched_documents = std::move(all_documents);
+    }
+
+    //Обход всех списков одновременно по возрастанию id: релевантность документа считается целиком
+    //в порядке слов запроса, минус-слова проверяются до подсчёта
+    template <typename DocumentPredicate>
+    std::vector<Document> FindAllDocumentsByDocument(const Query& query, DocumentPredicate document_predicate, const CancellationToken* token) const {
+        struct Cursor {
+            DocumentFreqs::const_iterator it;
+            DocumentFreqs::const_iterator end;
+            double inverse_document_freq;
+        };
+        SmallVector<Cursor, QUERY_INLINE_WORD_COUNT> plus_cursors;
+        SmallVector<Cursor, QUERY_INLINE_WORD_COUNT> minus_cursors;
+        for (const QueryTerm& term : query.plus_words) {
+            if (term.postings != nullptr) {
+                plus_cursors.push_back({term.postings->begin(), term.postings->end(), term.inverse_document_freq});
+            }
+        }
+        for (const QueryTerm& term : query.minus_words) {
+            if (term.postings != nullptr) {
+                minus_cursors.push_back({term.postings->begin(), term.postings->end(), 0.0});
+            }
+        }
+
+        std::vector<Document> matched_documents;
+        int until_check = 0;
+        while (true) {
+            if (token != nullptr && --until_check <= 0) {
+                if (token->IsCancelled()) {
+                    throw QueryCancelled();
+                }
+                until_check = CANCELLATION_CHECK_INTERVAL;
+            }
+
+            bool has_document = false;
+            int document_id = 0;
+            for (const Cursor& cursor : plus_cursors) {
+                if (cursor.it != cursor.end && (!has_document || cursor.it->first < document_id)) {
+                    document_id = cursor.it->first;
+                    has_document = true;
+                }
+            }
+            if (!has_document) {
+                break;
+            }
+
+            bool excluded = false;
+            for (Cursor& cursor : minus_cursors) {
+                while (cursor.it != cursor.end && cursor.it->first < document_id) {
+                    ++cursor.it;
                 }
+                if (cursor.it != cursor.end && cursor.it->first == document_id) {
+                    excluded = true;
+                    break;
+                }
+            }
+
+            double relevance = 0.0;
+            for (Cursor& cursor : plus_cursors) {
+                if (cursor.it != cursor.end && cursor.it->first == document_id) {
+                    if (!excluded) {
+                        relevance += cursor.it->second * cursor.inverse_document_freq;
+                    }
+                    ++cursor.it;
+                }
+            }
+            if (excluded) {
+                continue;
+            }
+
+            if (IsAccepted(document_predicate, document_id)) {
+                matched_documents.push_back({document_id, relevance, documents_.at(document_id).rating});
             }
         }
 
-        for (const auto word : query.minus_words) {
-            if (word_to_document_freqs_.count(word) == 0) {
+        return matched_documents;
+    }
+
+    template <typename DocumentPredicate>
+    std::vector<Document> FindAllDocuments(std::execution::sequenced_policy, const Query& query, DocumentPredicate document_predicate,
+                                           const CancellationToken* token = nullptr) const {
+        //Документы с минус-словами известны до подсчёта, их записи в списках плюс-слов пропускаются
+        const std::vector<int> excluded = CollectMinusDocuments(query);
+        std::map<int, double> document_to_relevance;
+        int until_check = 0;
+        for (const QueryTerm& term : query.plus_words) {
+            if (term.postings == nullptr) {
                 continue;
             }
-            for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-                document_to_relevance.erase(document_id);
+            const double inverse_document_freq = term.inverse_document_freq;
+            auto next_excluded = excluded.begin();
+            for (const auto [document_id, term_freq] : *term.postings) {
+                if (token != nullptr && --until_check <= 0) {
+                    if (token->IsCancelled()) {
+                        throw QueryCancelled();
+                    }
+                    until_check = CANCELLATION_CHECK_INTERVAL;
+                }
+                if (IsExcluded(excluded, next_excluded, document_id)) {
+                    continue;
+                }
+                if (IsAccepted(document_predicate, document_id)) {
+                    document_to_relevance[document_id] += term_freq * inverse_document_freq;
+                }
             }
         }
 
@@ -214,39 +1079,255 @@ private:
 
 
 
-      template <typename DocumentPredicate>
-      std::vector<Document> FindAllDocuments(std::execution::parallel_policy , const Query& query, DocumentPredicate document_predicate) const {
-        ConcurrentMap<int, double> document_to_relevance(101);
-        ForEach(std::execution::par, query.plus_words, [this, &document_to_relevance, &document_predicate](const auto &word) {
-            if (!(word_to_document_freqs_.count(word) == 0)) {
-              const double inverse_document_freq = std::log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(word).size());
-              for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-                  const auto& document_data = documents_.at(document_id);
-                  if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                      document_to_relevance[document_id].ref_to_value += term_freq * inverse_document_freq;
-                  }
-              }
+    template <typename ExecutionPolicy>
+    void RemoveDocumentsImpl(ExecutionPolicy policy, const std::vector<int>& document_ids) {
+        std::vector<int> ids;
+        ids.reserve(document_ids.size());
+        for (const int document_id : document_ids) {
+            if (documents_.count(document_id)) {
+                ids.push_back(document_id);
+            }
+        }
+        std::sort(policy, ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+        if (ids.empty()) {
+            return;
+        }
+
+        //Прямой индекс удаляемых документов; у документа без слов его нет
+        std::vector<DocumentToWordFreqs::iterator> forward(ids.size());
+        std::vector<size_t> offsets(ids.size() + 1, 0);
+        for (size_t i = 0; i < ids.size(); ++i) {
+            forward[i] = id_words_freg_.find(ids[i]);
+            offsets[i + 1] = offsets[i] + (forward[i] == id_words_freg_.end() ? 0 : forward[i]->second.size());
+        }
+        std::vector<size_t> indexes(ids.size());
+        std::iota(indexes.begin(), indexes.end(), 0);
+
+        struct Posting {
+            std::string_view word;
+            int document_id;
+        };
+        std::vector<Posting> postings(offsets.back());
+        std::for_each(policy, indexes.begin(), indexes.end(), [&](size_t i) {
+            if (forward[i] == id_words_freg_.end()) {
+                return;
+            }
+            size_t position = offsets[i];
+            for (const auto& [word, _] : forward[i]->second) {
+                postings[position++] = {word, ids[i]};
             }
         });
 
+        //Слова интернированы: у одного слова во всех записях один и тот же адрес
+        std::sort(policy, postings.begin(), postings.end(), [](const Posting& lhs, const Posting& rhs) {
+            return std::less<const char*>()(lhs.word.data(), rhs.word.data())
+                   || (lhs.word.data() == rhs.word.data() && lhs.document_id < rhs.document_id);
+        });
+        std::vector<size_t> group_begins;
+        for (size_t i = 0; i < postings.size(); ++i) {
+            if (i == 0 || postings[i].word.data() != postings[i - 1].word.data()) {
+                group_begins.push_back(i);
+            }
+        }
+        group_begins.push_back(postings.size());
 
-        ForEach(std::execution::par, query.minus_words, [this, &document_to_relevance](const auto &word){
-            if (!(word_to_document_freqs_.count(word) == 0)) {
-              for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-                document_to_relevance.erase(document_id);
+        //Каждое слово со своим списком документов принадлежит одному потоку
+        std::vector<WordToDocumentFreqs::iterator> words(group_begins.size() - 1);
+        std::vector<size_t> groups(words.size());
+        std::iota(groups.begin(), groups.end(), 0);
+        std::for_each(policy, groups.begin(), groups.end(), [&](size_t group) {
+            words[group] = word_to_document_freqs_.find(postings[group_begins[group]].word);
+            auto& document_freqs = words[group]->second;
+            for (size_t i = group_begins[group]; i < group_begins[group + 1]; ++i) {
+                document_freqs.erase(postings[i].document_id);
+            }
+        });
+        //Узлы прямого индекса освобождаются параллельно, сами записи удаляются ниже
+        std::for_each(policy, indexes.begin(), indexes.end(), [&](size_t i) {
+            if (forward[i] != id_words_freg_.end()) {
+                forward[i]->second.clear();
+            }
+        });
+
+        for (const auto word_it : words) {
+            const std::string_view word = word_it->first;
+            if (!word_it->second.empty()) {
+                MarkWordChanged(word);
+                continue;
+            }
+            EraseWordCaches(word);
+            word_to_document_freqs_.erase(word_it);
+            words_.erase(words_.find(word));
+        }
+
+        for (size_t i = 0; i < ids.size(); ++i) {
+            const auto document = documents_.find(ids[i]);
+            ratings_.erase({document->second.status, document->second.rating, ids[i]});
+            --status_counts_[static_cast<int>(document->second.status)];
+            document_store_.Remove(document->second.text);
+            if (positions_ != nullptr) {
+                positions_->Remove(ids[i]);
+            }
+            documents_.erase(document);
+            set_id_.erase(ids[i]);
+            if (forward[i] != id_words_freg_.end()) {
+                id_words_freg_.erase(forward[i]);
+            }
+        }
+    }
+
+    //Пересечение отсортированных слов запроса с прямым индексом документа
+    template <typename ExecutionPolicy>
+    void MatchDocumentsImpl(ExecutionPolicy policy, const std::string_view raw_query, const std::vector<int>& document_ids, MatchedDocuments& result) const {
+        const auto query = ParseQuery(raw_query);
+
+        //Префикс и фраза могут совпасть с несколькими словами документа, место под них — по числу слов документа
+        result.documents.resize(document_ids.size());
+        size_t words_size = 0;
+        for (size_t i = 0; i < document_ids.size(); ++i) {
+            const auto document = documents_.find(document_ids[i]);
+            if (document == documents_.end()) {
+                throw std::out_of_range("No valid id" + std::to_string(document_ids[i]));
+            }
+            result.documents[i] = {document_ids[i], document->second.status, words_size, 0};
+            if (query.HasExpandedTerms()) {
+                const auto document_words = id_words_freg_.find(document_ids[i]);
+                words_size += GetMatchCapacity(query, document_words == id_words_freg_.end() ? 0 : document_words->second.size());
+            } else {
+                words_size += query.plus_words.size();
+            }
+        }
+        result.words.resize(words_size);
+
+        std::for_each(policy, result.documents.begin(), result.documents.end(), [this, &query, &result](MatchedDocument& match) {
+            const auto document_words = id_words_freg_.find(match.document_id);
+            if (document_words == id_words_freg_.end()) {
+                return;
+            }
+            const auto& words = document_words->second;
+            const auto starts_with = [](const std::string_view word, const std::string_view prefix) {
+                return word.substr(0, prefix.size()) == prefix;
+            };
+
+            //Фразы не сравниваются со словами документа, их документы уже в списке
+            for (const QueryTerm& term : query.minus_words) {
+                if (term.is_phrase && term.postings != nullptr && term.postings->count(match.document_id)) {
+                    return;
+                }
+            }
+
+            auto word_it = words.begin();
+            for (const QueryTerm& term : query.minus_words) {
+                if (term.is_phrase) {
+                    continue;
+                }
+                while (word_it != words.end() && word_it->first < term.word) {
+                    ++word_it;
+                }
+                if (word_it == words.end()) {
+                    break;
+                }
+                if (word_it->first == term.word || (term.is_prefix && starts_with(word_it->first, term.word))) {
+                    return;
+                }
+            }
+
+            for (const QueryTerm& term : query.plus_words) {
+                if (term.is_phrase && term.postings != nullptr && term.postings->count(match.document_id)) {
+                    for (const std::string_view word : FindExpansion(query, term).words) {
+                        result.words[match.words_begin + match.words_count] = word;
+                        ++match.words_count;
+                    }
+                }
+            }
+
+            word_it = words.begin();
+            for (const QueryTerm& term : query.plus_words) {
+                if (term.postings == nullptr || term.is_phrase) {
+                    continue;
+                }
+                while (word_it != words.end() && word_it->first < term.word) {
+                    ++word_it;
+                }
+                if (word_it == words.end()) {
+                    break;
+                }
+                if (term.is_prefix) {
+                    //Слова сверх MAX_PREFIX_EXPANSIONS в список префикса не вошли и не совпадают, как и при поиске
+                    if (!term.postings->count(match.document_id)) {
+                        continue;
+                    }
+                    const auto& kept_words = FindExpansion(query, term).words;
+                    //Указатель не сдвигается: следующие слова запроса могут лежать внутри этого диапазона
+                    for (auto it = word_it; it != words.end() && starts_with(it->first, term.word); ++it) {
+                        if (std::binary_search(kept_words.begin(), kept_words.end(), it->first)) {
+                            result.words[match.words_begin + match.words_count] = it->first;
+                            ++match.words_count;
+                        }
+                    }
+                } else if (word_it->first == term.word) {
+                    result.words[match.words_begin + match.words_count] = term.word;
+                    ++match.words_count;
+                }
+            }
+
+            if (query.HasExpandedTerms()) {
+                const auto begin = result.words.begin() + match.words_begin;
+                std::sort(begin, begin + match.words_count);
+                match.words_count = std::unique(begin, begin + match.words_count) - begin;
+            }
+        });
+    }
+
+      //Исключение из параллельного обхода завершило бы программу: при отмене потоки просто
+      //бросают свои списки, а QueryCancelled бросается после обхода
+      template <typename DocumentPredicate>
+      std::vector<Document> FindAllDocuments(std::execution::parallel_policy , const Query& query, DocumentPredicate document_predicate,
+                                             const CancellationToken* token = nullptr) const {
+        const std::vector<int> excluded = CollectMinusDocuments(query);
+        ConcurrentMap<int, double> document_to_relevance(101);
+        ForEach(std::execution::par, query.plus_words, [this, &document_to_relevance, &document_predicate, &excluded, token](const QueryTerm& term) {
+            if (term.postings != nullptr) {
+              const double inverse_document_freq = term.inverse_document_freq;
+              auto next_excluded = excluded.begin();
+              int until_check = 0;
+              for (const auto [document_id, term_freq] : *term.postings) {
+                  if (token != nullptr && --until_check <= 0) {
+                      if (token->IsCancelled()) {
+                          return;
+                      }
+                      until_check = CANCELLATION_CHECK_INTERVAL;
+                  }
+                  if (IsExcluded(excluded, next_excluded, document_id)) {
+                      continue;
+                  }
+                  if (IsAccepted(document_predicate, document_id)) {
+                      document_to_relevance.Add(document_id, term_freq * inverse_document_freq);
+                  }
               }
             }
         });
+        //Отмена и истёкший срок не снимаются, поэтому повторная проверка видит то же, что и потоки
+        if (token != nullptr && token->IsCancelled()) {
+            throw QueryCancelled();
+        }
 
+        auto relevances = document_to_relevance.Extract(std::execution::par);
+        std::sort(std::execution::par, relevances.begin(), relevances.end());
         std::vector<Document> matched_documents;
-        for (const auto [document_id, relevance] : document_to_relevance.BuildOrdinaryMap()) {
-            matched_documents.push_back({std::move(document_id), std::move(relevance), documents_.at(document_id).rating});
+        matched_documents.reserve(relevances.size());
+        for (const auto& [document_id, relevance] : relevances) {
+            matched_documents.push_back({document_id, relevance, documents_.at(document_id).rating});
         }
 
         return matched_documents;
         }
 };
 
+//Отладочный вывод плана запроса
+std::ostream& operator<<(std::ostream& out, const SearchServer::QueryPlan& plan);
+
 
 
 
@@ -0,0 +1,166 @@
+#include "sharded_search_server.h"
+#include <exception>
+#include <map>
+
+ShardedSearchServer::ShardedSearchServer(const std::string_view stop_words_text, size_t shard_count, const SearchServerOptions& options)
+  :ShardedSearchServer(SplitIntoWords(stop_words_text), shard_count, options){}
+
+ShardedSearchServer::ShardedSearchServer(const std::string& stop_words_text, size_t shard_count, const SearchServerOptions& options)
+  :ShardedSearchServer(SplitIntoWords(stop_words_text), shard_count, options){}
+
+void ShardedSearchServer::AddDocument(int document_id, const std::string_view document, DocumentStatus status, const std::vector<int>& ratings) {
+  if (document_id < 0) {
+      throw std::invalid_argument("Invalid document_id");
+  }
+  shards_[GetShardIndex(document_id)].AddDocument(document_id, document, status, ratings);
+}
+
+void ShardedSearchServer::AddDocuments(std::execution::parallel_policy, const std::vector<DocumentInput>& documents) {
+  std::vector<std::vector<const DocumentInput*>> shard_documents(shards_.size());
+  for (const auto& document : documents) {
+      if (document.id < 0) {
+          throw std::invalid_argument("Invalid document_id");
+      }
+      shard_documents[GetShardIndex(document.id)].push_back(&document);
+  }
+
+  //Исключение внутри параллельного алгоритма завершило бы программу, поэтому переносим его наружу
+  std::vector<std::exception_ptr> errors(shards_.size());
+  std::vector<size_t> indexes(shards_.size());
+  std::iota(indexes.begin(), indexes.end(), 0);
+  std::for_each(std::execution::par, indexes.begin(), indexes.end(), [this, &shard_documents, &errors](size_t index) {
+      try {
+          for (const DocumentInput* document : shard_documents[index]) {
+              shards_[index].AddDocument(document->id, document->text, document->status, document->ratings);
+          }
+      } catch (...) {
+          errors[index] = std::current_exception();
+      }
+  });
+  RethrowFirstError(errors);
+}
+
+void ShardedSearchServer::RemoveDocument(int document_id) {
+  if (document_id < 0) {
+      return;
+  }
+  shards_[GetShardIndex(document_id)].RemoveDocument(document_id);
+}
+
+void ShardedSearchServer::RemoveDocuments(std::execution::parallel_policy, const std::vector<int>& document_ids) {
+  std::vector<std::vector<int>> shard_ids(shards_.size());
+  for (const int document_id : document_ids) {
+      if (document_id >= 0) {
+          shard_ids[GetShardIndex(document_id)].push_back(document_id);
+      }
+  }
+
+  std::vector<std::exception_ptr> errors(shards_.size());
+  std::vector<size_t> indexes(shards_.size());
+  std::iota(indexes.begin(), indexes.end(), 0);
+  std::for_each(std::execution::par, indexes.begin(), indexes.end(), [this, &shard_ids, &errors](size_t index) {
+      try {
+          shards_[index].RemoveDocuments(std::execution::par, shard_ids[index]);
+      } catch (...) {
+          errors[index] = std::current_exception();
+      }
+  });
+  RethrowFirstError(errors);
+}
+
+std::vector<Document> ShardedSearchServer::FindTopDocuments(const std::string_view raw_query, DocumentStatus status) const {
+  //Статус уходит в шарды как есть, чтобы они отбирали документы по колонке рейтингов
+  return FindTopDocuments<DocumentStatus>(raw_query, status);
+}
+
+std::vector<Document> ShardedSearchServer::FindTopDocuments(const std::string_view raw_query) const {
+  return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> ShardedSearchServer::MatchDocument(const std::string_view raw_query, int document_id) const {
+  if (document_id < 0) {
+      throw std::out_of_range("No valid id" + std::to_string(document_id));
+  }
+  return shards_[GetShardIndex(document_id)].MatchDocument(raw_query, document_id);
+}
+
+int ShardedSearchServer::GetDocumentCount() const {
+  int count = 0;
+  for (const auto& shard : shards_) {
+      count += shard.GetDocumentCount();
+  }
+  return count;
+}
+
+size_t ShardedSearchServer::GetShardCount() const {
+  return shards_.size();
+}
+
+const SearchServer& ShardedSearchServer::GetShard(size_t index) const {
+  return shards_.at(index);
+}
+
+//Перемешиваем биты, чтобы подряд идущие id расходились по разным шардам равномерно
+size_t ShardedSearchServer::GetShardIndex(int document_id) const {
+  const uint64_t hash = static_cast<uint32_t>(document_id) * 0x9E3779B97F4A7C15ull;
+  return (hash >> 32) % shards_.size();
+}
+
+void ShardedSearchServer::RethrowFirstError(const std::vector<std::exception_ptr>& errors) {
+  for (const auto& error : errors) {
+      if (error) {
+          std::rethrow_exception(error);
+      }
+  }
+}
+
+void ShardedSearchServer::SelectGlobalPrefixWords(std::vector<SearchServer::Query>& queries) const {
+  const size_t word_count = queries.front().plus_words.size();
+  for (size_t word = 0; word < word_count; ++word) {
+      if (!queries.front().plus_words[word].is_prefix) {
+          continue;
+      }
+      //Текст слова может принадлежать раскрытию, которое заменит RestrictPrefix
+      const std::string prefix(queries.front().plus_words[word].word);
+      std::map<std::string_view, size_t> counts;
+      for (const auto& shard : shards_) {
+          for (const auto& [prefix_word, document_count] : shard.GetPrefixWordCounts(prefix)) {
+              counts[prefix_word] += document_count;
+          }
+      }
+      if (counts.size() <= MAX_PREFIX_EXPANSIONS) {
+          continue;
+      }
+      std::vector<std::pair<std::string_view, size_t>> selected(counts.begin(), counts.end());
+      SearchServer::SelectPrefixWords(selected, MAX_PREFIX_EXPANSIONS);
+      std::vector<std::string_view> words;
+      words.reserve(selected.size());
+      for (const auto& [prefix_word, _] : selected) {
+          words.push_back(prefix_word);
+      }
+      for (size_t i = 0; i < shards_.size(); ++i) {
+          shards_[i].RestrictPrefix(queries[i], prefix, words);
+      }
+  }
+}
+
+void ShardedSearchServer::ApplyGlobalInverseDocumentFreqs(std::vector<SearchServer::Query>& queries) const {
+  const int document_count = GetDocumentCount();
+  //Слова в запросах всех шардов идут в одном порядке, так как отсортированы по тексту
+  const size_t word_count = queries.front().plus_words.size();
+  for (size_t word = 0; word < word_count; ++word) {
+      size_t word_document_count = 0;
+      for (const auto& query : queries) {
+          if (query.plus_words[word].postings != nullptr) {
+              word_document_count += query.plus_words[word].postings->size();
+          }
+      }
+      if (word_document_count == 0) {
+          continue;
+      }
+      const double inverse_document_freq = SearchServer::ComputeWordInverseDocumentFreq(document_count, word_document_count);
+      for (auto& query : queries) {
+          query.plus_words[word].inverse_document_freq = inverse_document_freq;
+      }
+  }
+}
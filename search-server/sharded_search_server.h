@@ -0,0 +1,100 @@
+#pragma once
+#include "search_server.h"
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <execution>
+#include <numeric>
+#include <string_view>
+#include <vector>
+
+//Поисковый сервер, разбитый по документам на несколько SearchServer.
+//Запрос уходит во все шарды параллельно, IDF считается по всему корпусу,
+//поэтому релевантность совпадает с результатом одного большого сервера.
+class ShardedSearchServer {
+public:
+    struct DocumentInput {
+        int id;
+        std::string_view text;
+        DocumentStatus status;
+        std::vector<int> ratings;
+    };
+
+    template <typename StringContainer>
+    ShardedSearchServer(const StringContainer& stop_words, size_t shard_count, const SearchServerOptions& options = {}) {
+        if (shard_count == 0) {
+            throw std::invalid_argument("Shard count must be positive");
+        }
+        shards_.reserve(shard_count);
+        for (size_t i = 0; i < shard_count; ++i) {
+            shards_.emplace_back(stop_words, options);
+        }
+    }
+
+    ShardedSearchServer(const std::string_view stop_words_text, size_t shard_count, const SearchServerOptions& options = {});
+    ShardedSearchServer(const std::string& stop_words_text, size_t shard_count, const SearchServerOptions& options = {});
+
+    void AddDocument(int document_id, const std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+    //Каждый шард добавляет свою часть документов в отдельном потоке
+    void AddDocuments(std::execution::parallel_policy, const std::vector<DocumentInput>& documents);
+
+    void RemoveDocument(int document_id);
+    void RemoveDocuments(std::execution::parallel_policy, const std::vector<int>& document_ids);
+
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentPredicate document_predicate) const {
+        std::vector<SearchServer::Query> queries(shards_.size());
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            shards_[i].ParseQuery(raw_query, queries[i]);
+        }
+        SelectGlobalPrefixWords(queries);
+        ApplyGlobalInverseDocumentFreqs(queries);
+
+        //Исключение шарда, например из предиката, переносится наружу, как в AddDocuments
+        std::vector<std::vector<Document>> shard_documents(shards_.size());
+        std::vector<std::exception_ptr> errors(shards_.size());
+        std::vector<size_t> indexes(shards_.size());
+        std::iota(indexes.begin(), indexes.end(), 0);
+        std::for_each(std::execution::par, indexes.begin(), indexes.end(),
+                      [this, &queries, &shard_documents, &errors, &document_predicate](size_t index) {
+                          try {
+                              shard_documents[index] = shards_[index].FindTopDocuments(std::execution::seq, queries[index], document_predicate);
+                          } catch (...) {
+                              errors[index] = std::current_exception();
+                          }
+                      });
+        RethrowFirstError(errors);
+
+        //В каждом шарде уже свой топ, достаточно слить их и обрезать
+        std::vector<Document> matched_documents;
+        matched_documents.reserve(shards_.size() * MAX_RESULT_DOCUMENT_COUNT);
+        for (const auto& documents : shard_documents) {
+            matched_documents.insert(matched_documents.end(), documents.begin(), documents.end());
+        }
+        //Равные документы упорядочены по id, как и внутри шардов, поэтому топ совпадает с одним сервером
+        SearchServer::SelectTopDocuments<MAX_RESULT_DOCUMENT_COUNT, RelevanceOrder>(matched_documents);
+        return matched_documents;
+    }
+
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentStatus status) const;
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query) const;
+
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::string_view raw_query, int document_id) const;
+
+    int GetDocumentCount() const;
+    size_t GetShardCount() const;
+    const SearchServer& GetShard(size_t index) const;
+
+private:
+    std::vector<SearchServer> shards_;
+
+    size_t GetShardIndex(int document_id) const;
+    //Первое исключение из собранных по шардам
+    static void RethrowFirstError(const std::vector<std::exception_ptr>& errors);
+
+    //Префикс сверх MAX_PREFIX_EXPANSIONS слов во всех шардах раскрывается в одни и те же слова,
+    //самые частые по всему корпусу, как у одного сервера
+    void SelectGlobalPrefixWords(std::vector<SearchServer::Query>& queries) const;
+    //Замена IDF в запросах шардов на значения, посчитанные по всем шардам сразу
+    void ApplyGlobalInverseDocumentFreqs(std::vector<SearchServer::Query>& queries) const;
+};
@@ -0,0 +1,83 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <vector>
+
+//Вектор с встроенным буфером на N элементов, в кучу уходит только при переполнении.
+//Рассчитан на простые типы (string_view, указатели, небольшие структуры)
+template <typename T, size_t N>
+class SmallVector {
+public:
+    using value_type = T;
+    using iterator = T*;
+    using const_iterator = const T*;
+
+    SmallVector() = default;
+
+    SmallVector(const SmallVector& other) {
+        *this = other;
+    }
+
+    SmallVector& operator=(const SmallVector& other) {
+        if (this != &other) {
+            clear();
+            for (const T& value : other) {
+                push_back(value);
+            }
+        }
+        return *this;
+    }
+
+    void push_back(const T& value) {
+        if (size_ < N) {
+            inline_[size_] = value;
+        } else {
+            if (size_ == N) {
+                heap_.assign(inline_.begin(), inline_.end());
+            }
+            heap_.push_back(value);
+        }
+        ++size_;
+    }
+
+    //Сброс без освобождения памяти, чтобы переиспользовать между запросами
+    void clear() {
+        size_ = 0;
+        heap_.clear();
+    }
+
+    void resize_down(size_t new_size) {
+        if (new_size >= size_) {
+            return;
+        }
+        if (size_ > N) {
+            if (new_size <= N) {
+                std::copy(heap_.begin(), heap_.begin() + new_size, inline_.begin());
+                heap_.clear();
+            } else {
+                heap_.resize(new_size);
+            }
+        }
+        size_ = new_size;
+    }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    T* data() { return size_ > N ? heap_.data() : inline_.data(); }
+    const T* data() const { return size_ > N ? heap_.data() : inline_.data(); }
+
+    T& operator[](size_t index) { return data()[index]; }
+    const T& operator[](size_t index) const { return data()[index]; }
+
+    iterator begin() { return data(); }
+    iterator end() { return data() + size_; }
+    const_iterator begin() const { return data(); }
+    const_iterator end() const { return data() + size_; }
+
+private:
+    std::array<T, N> inline_{};
+    std::vector<T> heap_;
+    size_t size_ = 0;
+};
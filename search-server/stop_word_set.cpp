@@ -0,0 +1,34 @@
+#include "stop_word_set.h"
+
+void StopWordSet::Build(const std::vector<std::string_view>& words) {
+    size_ = words.size();
+    if (words.empty()) {
+        return;
+    }
+
+    //Заполненность таблицы не больше половины, чтобы цепочки проб были короткими
+    size_t capacity = 2;
+    while (capacity < 2 * words.size()) {
+        capacity *= 2;
+    }
+    slots_.assign(capacity, Slot{});
+
+    size_t total_length = 0;
+    for (const auto word : words) {
+        total_length += word.size();
+    }
+    storage_.reserve(total_length);
+
+    for (const auto word : words) {
+        const Slot slot{static_cast<uint32_t>(storage_.size()), static_cast<uint32_t>(word.size())};
+        storage_.append(word);
+
+        AddToFilters(word);
+
+        size_t index = HashStopWord(word) & (capacity - 1);
+        while (slots_[index].length != 0) {
+            index = (index + 1) & (capacity - 1);
+        }
+        slots_[index] = slot;
+    }
+}
@@ -0,0 +1,180 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//FNV-1a, constexpr чтобы таблицу можно было построить при компиляции
+constexpr uint64_t HashStopWord(std::string_view word) {
+    uint64_t hash = 14695981039346656037ull;
+    for (const char c : word) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+template <size_t N>
+class StaticStopWordSet;
+
+//Неизменяемое множество стоп-слов: открытая адресация с линейным пробированием.
+//Перед поиском в таблице слово отсекается по длине и первому байту,
+//так что большинство обычных слов не доходит до хеширования.
+class StopWordSet {
+public:
+    StopWordSet() = default;
+
+    template <typename StringContainer>
+    explicit StopWordSet(const StringContainer& words) {
+        std::vector<std::string_view> unique_words;
+        for (const auto& word : words) {
+            if (!std::string_view(word).empty()) {
+                unique_words.push_back(word);
+            }
+        }
+        std::sort(unique_words.begin(), unique_words.end());
+        unique_words.erase(std::unique(unique_words.begin(), unique_words.end()), unique_words.end());
+        Build(unique_words);
+    }
+
+    //Поиск идёт по готовой таблице StaticStopWordSet (её копии), своя таблица не строится
+    template <size_t N>
+    explicit StopWordSet(const StaticStopWordSet<N>& words)
+        : static_set_(std::make_shared<const StaticStopWordSet<N>>(words))
+        , static_contains_([](const void* set, std::string_view word) {
+              return static_cast<const StaticStopWordSet<N>*>(set)->Contains(word);
+          }) {
+        std::vector<std::string_view> unique_words;
+        for (const std::string_view word : words) {
+            if (!word.empty()) {
+                unique_words.push_back(word);
+            }
+        }
+        std::sort(unique_words.begin(), unique_words.end());
+        size_ = std::unique(unique_words.begin(), unique_words.end()) - unique_words.begin();
+        for (const std::string_view word : words) {
+            if (!word.empty()) {
+                AddToFilters(word);
+            }
+        }
+    }
+
+    bool Contains(const std::string_view word) const {
+        if (word.empty() || size_ == 0) {
+            return false;
+        }
+        if (((length_mask_ >> std::min<size_t>(word.size(), 63)) & 1) == 0) {
+            return false;
+        }
+        const unsigned char first = static_cast<unsigned char>(word[0]);
+        if (((first_bytes_[first >> 6] >> (first & 63)) & 1) == 0) {
+            return false;
+        }
+        if (static_contains_ != nullptr) {
+            return static_contains_(static_set_.get(), word);
+        }
+        for (size_t slot = HashStopWord(word) & (slots_.size() - 1);; slot = (slot + 1) & (slots_.size() - 1)) {
+            const Slot& candidate = slots_[slot];
+            if (candidate.length == 0) {
+                return false;
+            }
+            if (GetWord(candidate) == word) {
+                return true;
+            }
+        }
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    struct Slot {
+        uint32_t offset = 0;
+        uint32_t length = 0;
+    };
+
+    //Все слова подряд в одной строке
+    std::string storage_;
+    std::vector<Slot> slots_;
+    size_t size_ = 0;
+    uint64_t length_mask_ = 0;
+    std::array<uint64_t, 4> first_bytes_{};
+    //Таблица, построенная при компиляции, вместо slots_
+    std::shared_ptr<const void> static_set_;
+    bool (*static_contains_)(const void*, std::string_view) = nullptr;
+
+    std::string_view GetWord(const Slot& slot) const {
+        return std::string_view(storage_).substr(slot.offset, slot.length);
+    }
+
+    void Build(const std::vector<std::string_view>& words);
+
+    void AddToFilters(const std::string_view word) {
+        length_mask_ |= uint64_t{1} << std::min<size_t>(word.size(), 63);
+        const unsigned char first = static_cast<unsigned char>(word[0]);
+        first_bytes_[first >> 6] |= uint64_t{1} << (first & 63);
+    }
+};
+
+//Вариант для списка, известного при компиляции: таблица строится constexpr-конструктором
+//    constexpr StaticStopWordSet stop_words(std::array<std::string_view, 2>{"in"sv, "the"sv});
+//Конструктор SearchServer ищет стоп-слова прямо в этой таблице. Слова должны жить не меньше
+//сервера (обычно это строковые литералы).
+template <size_t N>
+class StaticStopWordSet {
+public:
+    constexpr explicit StaticStopWordSet(const std::array<std::string_view, N>& words)
+        : words_(words) {
+        for (size_t i = 0; i < N; ++i) {
+            if (words_[i].empty()) {
+                continue;
+            }
+            size_t slot = HashStopWord(words_[i]) & (CAPACITY - 1);
+            while (slots_[slot] != 0 && words_[slots_[slot] - 1] != words_[i]) {
+                slot = (slot + 1) & (CAPACITY - 1);
+            }
+            slots_[slot] = i + 1;
+        }
+    }
+
+    constexpr bool Contains(const std::string_view word) const {
+        if (word.empty()) {
+            return false;
+        }
+        for (size_t slot = HashStopWord(word) & (CAPACITY - 1);; slot = (slot + 1) & (CAPACITY - 1)) {
+            if (slots_[slot] == 0) {
+                return false;
+            }
+            if (words_[slots_[slot] - 1] == word) {
+                return true;
+            }
+        }
+    }
+
+    constexpr auto begin() const {
+        return words_.begin();
+    }
+
+    constexpr auto end() const {
+        return words_.end();
+    }
+
+private:
+    static constexpr size_t ComputeCapacity() {
+        size_t capacity = 2;
+        while (capacity < 2 * N) {
+            capacity *= 2;
+        }
+        return capacity;
+    }
+
+    static constexpr size_t CAPACITY = ComputeCapacity();
+
+    std::array<std::string_view, N> words_;
+    //Номер слова + 1, ноль означает пустую ячейку
+    std::array<size_t, CAPACITY> slots_{};
+};
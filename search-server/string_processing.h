@@ -3,8 +3,24 @@
 #include <vector>
 #include <set>
 #include <iostream>
+#include <string_view>
 std::vector<std::string_view> SplitIntoWords(const std::string_view text);
 
+//Обход слов строки без построения вектора
+template <typename Function>
+void ForEachWord(std::string_view text, Function function) {
+    while (!text.empty()) {
+        const auto space = text.find(' ');
+        if (space != 0) {
+            function(text.substr(0, space));
+        }
+        if (space == std::string_view::npos) {
+            break;
+        }
+        text.remove_prefix(space + 1);
+    }
+}
+
 
 template <typename StringContainer>
   std::set<std::string, std::less<>> MakeUniqueNonEmptyStrings(const StringContainer& strings) {
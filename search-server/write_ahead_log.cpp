@@ -0,0 +1,141 @@
+#include "write_ahead_log.h"
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+[[noreturn]] void ThrowSystemError(const std::string& what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+void CheckNotFailed(bool failed) {
+    if (failed) {
+        throw std::runtime_error("Write-ahead log is unusable after a write error");
+    }
+}
+
+}  // namespace
+
+WriteAheadLog::WriteAheadLog(const std::string& path)
+    : path_(path)
+    , fd_(open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644))
+{
+    if (fd_ < 0) {
+        ThrowSystemError("Cannot open write-ahead log " + path_);
+    }
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    try {
+        Sync(appended_);
+    } catch (...) {
+    }
+    close(fd_);
+}
+
+void WriteAheadLog::Replay(const std::function<void(std::string_view)>& handler) {
+    std::string data;
+    char chunk[1 << 16];
+    off_t offset = 0;
+    while (true) {
+        const ssize_t read_bytes = pread(fd_, chunk, sizeof(chunk), offset);
+        if (read_bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ThrowSystemError("Cannot read write-ahead log " + path_);
+        }
+        if (read_bytes == 0) {
+            break;
+        }
+        data.append(chunk, read_bytes);
+        offset += read_bytes;
+    }
+
+    size_t complete_end = 0;
+    while (true) {
+        const size_t line_end = data.find('\n', complete_end);
+        if (line_end == std::string::npos) {
+            break;
+        }
+        const std::string_view line(data.data() + complete_end, line_end - complete_end);
+        complete_end = line_end + 1;
+        if (!line.empty()) {
+            handler(line);
+        }
+    }
+
+    if (complete_end != data.size()) {
+        if (ftruncate(fd_, complete_end) != 0 || fsync(fd_) != 0) {
+            ThrowSystemError("Cannot truncate write-ahead log " + path_);
+        }
+    }
+}
+
+uint64_t WriteAheadLog::Append(const std::string_view record) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CheckNotFailed(failed_);
+    buffer_.append(record);
+    buffer_.push_back('\n');
+    return ++appended_;
+}
+
+void WriteAheadLog::Sync(uint64_t sequence) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (durable_ < sequence) {
+        CheckNotFailed(failed_);
+        if (syncing_) {
+            synced_.wait(lock);
+            continue;
+        }
+
+        //Этот поток сбрасывает всё накопленное, в том числе записи других писателей
+        syncing_ = true;
+        std::string batch;
+        batch.swap(buffer_);
+        const uint64_t batch_end = appended_;
+        lock.unlock();
+        try {
+            WriteBatch(batch);
+        } catch (...) {
+            lock.lock();
+            syncing_ = false;
+            failed_ = true;
+            synced_.notify_all();
+            throw;
+        }
+        lock.lock();
+        syncing_ = false;
+        durable_ = batch_end;
+        synced_.notify_all();
+    }
+}
+
+void WriteAheadLog::Truncate() {
+    Sync(appended_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (ftruncate(fd_, 0) != 0 || fsync(fd_) != 0) {
+        failed_ = true;
+        ThrowSystemError("Cannot truncate write-ahead log " + path_);
+    }
+}
+
+void WriteAheadLog::WriteBatch(const std::string& batch) {
+    size_t written = 0;
+    while (written < batch.size()) {
+        const ssize_t result = write(fd_, batch.data() + written, batch.size() - written);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ThrowSystemError("Cannot write to write-ahead log " + path_);
+        }
+        written += result;
+    }
+    if (fdatasync(fd_) != 0) {
+        ThrowSystemError("Cannot sync write-ahead log " + path_);
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+//Журнал операций в файле, записи только дописываются, по одной на строку.
+//Запись на диск общая для ждущих писателей (group commit): пока один поток делает fsync,
+//остальные копят записи в буфере, и следующий fsync сбрасывает их все сразу
+class WriteAheadLog {
+public:
+    explicit WriteAheadLog(const std::string& path);
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    //Вызывает handler для каждой целой записи файла по порядку. Недописанный при сбое хвост отрезается.
+    //Вызывается до первого Append
+    void Replay(const std::function<void(std::string_view)>& handler);
+
+    //Ставит запись (без '\n') в буфер и возвращает её номер для Sync
+    uint64_t Append(const std::string_view record);
+    //Ждёт, пока запись sequence и все записи до неё окажутся на диске
+    void Sync(uint64_t sequence);
+    //Сбрасывает буфер на диск и очищает файл. Не вызывается одновременно с Append
+    void Truncate();
+
+private:
+    std::string path_;
+    int fd_ = -1;
+
+    std::mutex mutex_;
+    std::condition_variable synced_;
+    std::string buffer_;
+    uint64_t appended_ = 0;
+    uint64_t durable_ = 0;
+    bool syncing_ = false;
+    //После ошибки записи неизвестно, что дошло до диска, журнал больше не принимает записи
+    bool failed_ = false;
+
+    void WriteBatch(const std::string& batch);
+};